@@ -38,6 +38,10 @@
   "syn-mix-short.rep",	\
   "ngram-fox1.rep", \
   "syn-mix-realloc.rep",	\
+  "syn-mini-churn.rep",	\
+  "syn-grow.rep",	\
+  "syn-large-churn.rep",	\
+  "syn-batch.rep",	\
   "bdd-aa4.rep", \
   "bdd-aa32.rep", \
   "bdd-ma4.rep", \
@@ -120,6 +124,18 @@
  */
 #define ALIGNMENT 16
 
+/*
+ * Latency measurement (-L): number of runs of each trace, each operation
+ * being charged its fastest run, and the most allocator engines compared
+ */
+#define LATENCY_RUNS 3
+#define MAX_ENGINES 4
+
+/*
+ * Free list order frontier (-P): the most class list orders compared
+ */
+#define MAX_ORDERS 4
+
 /*********** Parameters controlling dense memory version of heap ***********/
 /*
  * Maximum heap size in bytes
@@ -127,9 +143,23 @@
 #define MAX_DENSE_HEAP (100*(1<<20))  /* 100 MB */
 
 /*
- * Starting address of the memory allocated for the heap by mmap
+ * Starting address of the memory allocated for the heap by mmap; only a
+ * hint, so the allocator may not rely on its alignment (see make skewcheck)
  */
+#ifndef TRY_DENSE_HEAP_START
 #define TRY_DENSE_HEAP_START (void *) 0x800000000
+#endif
+
+/*
+ * Granule in which mem_remap moves heap pages; remapping is off unless
+ * it is also the system page size
+ */
+#define REMAP_PAGE 4096
+
+/*
+ * Most mappings that mem_map keeps outside the heap at any one time
+ */
+#define MAX_MAPS 4096
 
 
 /*********** Parameters controlling sparse memory version of heap ***********/
@@ -36,6 +36,7 @@
 #define MAXLINE     1024          /* max string size */
 #define HDRLINES       4          /* number of header lines in a trace file */
 #define LINENUM(i) (i+HDRLINES+1) /* cnvt trace request nums to linenums (origin 1) */
+#define MAXORDEROPTS  32          /* max order options given with -o */
 
 #ifndef REF_ONLY
 #define REF_ONLY 0
@@ -81,9 +82,10 @@ typedef struct {
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum { ALLOC, FREE, REALLOC } type; /* type of request */
+    enum { ALLOC, FREE, REALLOC, ALLOC_BATCH, FREE_BATCH } type; /* type of request */
     long index;                         /* index for free() to use later */
     size_t size;                        /* byte size of alloc/realloc request */
+    int count;                          /* number of ids, from index on, in a batch */
 } traceop_t;
 
 /* Holds the information for one trace file */
@@ -96,6 +98,7 @@ typedef struct {
     traceop_t *ops;       /* array of requests */
     char **blocks;        /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes;  /* ... and a corresponding array of payload sizes */
+    int peak_op;          /* op after which the most payload bytes are allocated */
     int *block_rand_base; /* index into random_data, if debug is on */
 } trace_t;
 
@@ -123,6 +126,13 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;       /* space utilization for this trace (always 0 for libc) */
+    size_t sbrks;      /* mem_sbrk calls made while measuring util */
+    double maxlat[MAX_ENGINES]; /* slowest operation in usecs, per engine (-L) */
+    double order_util[MAX_ORDERS]; /* util and throughput in Kops/s ... */
+    double order_tput[MAX_ORDERS]; /* ... per free list order (-P) */
+    mm_stats_t alloc_peak;  /* allocator statistics at the peak of live data (-S) */
+    mm_stats_t alloc_end;   /* ... and at the end of the trace */
+    bool alloc_counted;     /* the allocator counts events */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -169,6 +179,26 @@ static size_t maxfill = SPARSE_MODE ? MAXFILL_SPARSE : MAXFILL;
 /* by default, no timeouts */
 static int set_timeout = 0;
 
+/* If set, measure the worst per-operation latency of every engine */
+static bool latency_mode = false;
+
+/* If set, free blocks with mm_free_sized, passing the size they were allocated with */
+static bool sized_mode = false;
+
+/* If set, print allocator statistics for each trace */
+static bool alloc_stats_mode = false;
+static int stats_op = -1;              /* op after which eval_mm_util takes ... */
+static mm_stats_t *stats_snapshot;     /* ... a snapshot of the statistics here */
+static int num_engines = 0;  /* engines accepted by mm_set_option */
+static long engine_opt = 0;  /* engine selected with -o */
+
+/* If set, measure util and throughput under every free list order */
+static bool order_mode = false;
+static int num_orders = 0;   /* orders accepted by mm_set_option */
+static int num_order_opts = 0;         /* order options given with -o, */
+static char *order_names[MAXORDEROPTS]; /* ... in command line order, */
+static long order_values[MAXORDEROPTS]; /* ... reapplied after -P */
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -225,9 +255,13 @@ static void eval_libc_speed(void *ptr);
 static bool eval_mm_valid(trace_t *trace, range_set_t *ranges);
 static double eval_mm_util(trace_t *trace, int tracenum);
 static void eval_mm_speed(void *ptr);
+static double eval_mm_latency(trace_t *trace);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
+static void printlatency(int n, stats_t *stats);
+static void printorders(int n, stats_t *stats);
+static void printallocstats(int n, stats_t *stats);
 static void usage(char *prog);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     __attribute__((format(printf, 3,4)));
@@ -273,8 +307,6 @@ static void run_tests(int num_tracefiles, const char *tracedir,
 
         trace_t *trace;
         trace = read_trace(&mm_stats[i], tracedir, tracefiles[i]);
-        strcpy(mm_stats[i].filename, trace->filename);
-        mm_stats[i].ops = trace->num_ops;
 
         /* Prepare for timeout */
         if (setjmp(timeout_jmpbuf) != 0) {
@@ -295,12 +327,43 @@ static void run_tests(int num_tracefiles, const char *tracedir,
             if (verbose > 1)
                 printf("efficiency, ");
             mm_stats[i].util = eval_mm_util(trace, i);
+            mm_stats[i].sbrks = mem_sbrk_calls();
             speed_params->trace = trace;
             speed_params->ranges = ranges;
             if (verbose > 1)
                 printf("and performance.\n");
             mm_stats[i].secs = sparse_mode ? 1.0 : fsec(eval_mm_speed, speed_params);
             mm_stats[i].tput = mm_stats[i].ops / (mm_stats[i].secs * 1000.0);
+
+            if (latency_mode) {
+                int e;
+                for (e = 0; e < MAX_ENGINES && mm_set_option("engine", e); e++)
+                    mm_stats[i].maxlat[e] = eval_mm_latency(trace);
+                num_engines = e;
+                mm_set_option("engine", engine_opt);
+            }
+
+            if (order_mode) {
+                int o;
+                for (o = 0; o < MAX_ORDERS && mm_set_option("order", o); o++) {
+                    mm_stats[i].order_util[o] = eval_mm_util(trace, i);
+                    mm_stats[i].order_tput[o] = mm_stats[i].ops /
+                        ((sparse_mode ? 1.0 : fsec(eval_mm_speed, speed_params)) * 1000.0);
+                }
+                num_orders = o;
+                mm_set_option("order", 0);
+                for (o = 0; o < num_order_opts; o++)
+                    mm_set_option(order_names[o], order_values[o]);
+            }
+
+            if (alloc_stats_mode) {
+                /* Replay the trace to take a snapshot at its peak */
+                stats_op = trace->peak_op;
+                stats_snapshot = &mm_stats[i].alloc_peak;
+                eval_mm_util(trace, i);
+                stats_op = -1;
+                mm_stats[i].alloc_counted = mm_get_stats(&mm_stats[i].alloc_end);
+            }
         }
 
         free_trace(trace);
@@ -348,7 +411,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hpOVAlDT")) != EOF) {
+    while ((c = getopt(argc, argv, "d:f:c:s:t:v:o:hpOVAlDLPSTz")) != EOF) {
         switch (c) {
 
         case 'A': /* Hidden Autolab driver argument */
@@ -405,6 +468,46 @@ int main(int argc, char **argv)
             tab_mode = true;
             break;
 
+        case 'z':
+            sized_mode = true;
+            break;
+        case 'L':
+            latency_mode = true;
+            break;
+
+        case 'P':
+            order_mode = true;
+            break;
+
+        case 'S':
+            alloc_stats_mode = true;
+            break;
+
+        case 'o': /* Set an allocator option, as name=value */
+        {
+            char *eq = strchr(optarg, '=');
+            if (eq == NULL) {
+                usage(argv[0]);
+                exit(1);
+            }
+            *eq = '\0';
+            if (strcmp(optarg, "engine") == 0)
+                engine_opt = strtol(eq + 1, NULL, 0);
+            if (!mm_set_option(optarg, strtol(eq + 1, NULL, 0))) {
+                fprintf(stderr, "Unknown allocator option %s=%s\n", optarg, eq + 1);
+                exit(1);
+            }
+            if (strncmp(optarg, "order", 5) == 0) {
+                if (num_order_opts == MAXORDEROPTS) {
+                    fprintf(stderr, "Too many order options (max %d)\n", MAXORDEROPTS);
+                    exit(1);
+                }
+                order_names[num_order_opts] = optarg;
+                order_values[num_order_opts++] = strtol(eq + 1, NULL, 0);
+            }
+            break;
+        }
+
         case 'h': /* Print this message */
             usage(argv[0]);
             exit(0);
@@ -497,6 +600,16 @@ int main(int argc, char **argv)
             printf("\nResults for mm malloc:\n");
             printresults(num_global_tracefiles, mm_stats, &global_mm_sum_stats);
             printf("\n");
+            if (latency_mode) {
+                printlatency(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (order_mode) {
+                printorders(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (alloc_stats_mode)
+                printallocstats(num_global_tracefiles, mm_stats);
         }
     }
 
@@ -696,9 +809,11 @@ static bool add_range(range_set_t *ranges, char *lo, size_t size,
         return false;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap, or within
+       a mapping the allocator made with mem_map */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+         (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+        !mem_is_mapped(lo, hi)) {
         malloc_error(trace, opnum,
                      "Payload (%p:%p) lies outside heap (%p:%p)",
                      lo, hi, mem_heap_lo(), mem_heap_hi());
@@ -874,9 +989,11 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     trace_t *trace;
     char type[MAXLINE];
     int index;
+    int count;
     size_t size;
     int max_index = 0;
     int op_index;
+    int batch_ops = 0;
     int ignore = 0;
 
     if (verbose > 1)
@@ -934,6 +1051,7 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
             trace->ops[op_index].type = ALLOC;
             trace->ops[op_index].index = index;
             trace->ops[op_index].size = size;
+            trace->block_sizes[index] = size;
             max_index = (index > max_index) ? index : max_index;
             break;
         case 'r':
@@ -941,12 +1059,32 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
             trace->ops[op_index].type = REALLOC;
             trace->ops[op_index].index = index;
             trace->ops[op_index].size = size;
+            trace->block_sizes[index] = size;
             max_index = (index > max_index) ? index : max_index;
             break;
         case 'f':
             ignore += fscanf(tracefile, "%u", &index);
             trace->ops[op_index].type = FREE;
             trace->ops[op_index].index = index;
+            /* the size it was allocated with, for mm_free_sized */
+            trace->ops[op_index].size =
+                ((int)index < 0) ? 0 : trace->block_sizes[index];
+            break;
+        case 'A':
+            ignore += fscanf(tracefile, "%u %d %lu", &index, &count, &size);
+            trace->ops[op_index].type = ALLOC_BATCH;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].count = count;
+            trace->ops[op_index].size = size;
+            max_index = (index + count - 1 > max_index) ? index + count - 1 : max_index;
+            batch_ops += count - 1;
+            break;
+        case 'F':
+            ignore += fscanf(tracefile, "%u %d", &index, &count);
+            trace->ops[op_index].type = FREE_BATCH;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].count = count;
+            batch_ops += count - 1;
             break;
         default:
             app_error("Bogus type character (%c) in tracefile %s\n",
@@ -962,7 +1100,8 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     /* fill in the stats */
     strcpy(stats->filename, trace->filename);
     stats->weight = trace->weight;
-    stats->ops = trace->num_ops;
+    /* A batch request counts once per block */
+    stats->ops = trace->num_ops + batch_ops;
 
     return trace;
 }
@@ -1000,7 +1139,7 @@ static void free_trace(trace_t *trace)
  */
 static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
 {
-    int i;
+    int i, j;
     int index;
     size_t size;
     char *newp;
@@ -1129,7 +1268,36 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
                 p = trace->blocks[index];
                 remove_range(ranges, p);
             }
-            mm_free(p);
+            if (sized_mode)
+                mm_free_sized(p, trace->ops[i].size);
+            else
+                mm_free(p);
+            break;
+
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            if (mm_malloc_batch(size, trace->ops[i].count,
+                                (void **)&trace->blocks[index])
+                != (size_t)trace->ops[i].count) {
+                malloc_error(trace, i, "mm_malloc_batch failed.");
+                return false;
+            }
+            for (j = index; j < index + trace->ops[i].count; j++) {
+                if (add_range(ranges, trace->blocks[j], size, trace, i, j) == 0)
+                    return false;
+                trace->block_sizes[j] = size;
+                randomize_block(trace, j);
+            }
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            for (j = index; j < index + trace->ops[i].count; j++) {
+                if (!check_index(trace, i, j))
+                {
+                    allCheck = false;
+                }
+                remove_range(ranges, trace->blocks[j]);
+            }
+            mm_free_batch((void **)&trace->blocks[index], trace->ops[i].count);
             break;
 
         default:
@@ -1154,7 +1322,7 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
  */
 static double eval_mm_util(trace_t *trace, int tracenum)
 {
-    int i;
+    int i, j;
     int index;
     size_t size, newsize, oldsize;
     size_t max_total_size = 0;
@@ -1163,6 +1331,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
     char *newp, *oldp;
 
     reinit_trace(trace);
+    trace->peak_op = 0;
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
@@ -1216,26 +1385,55 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                 p = trace->blocks[index];
             }
 
-            mm_free(p);
+            if (sized_mode)
+                mm_free_sized(p, trace->ops[i].size);
+            else
+                mm_free(p);
 
             total_size -= size;
             break;
 
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if (mm_malloc_batch(size, trace->ops[i].count,
+                                (void **)&trace->blocks[index])
+                != (size_t)trace->ops[i].count) {
+                app_error("trace %d: mm_malloc_batch failed in eval_mm_util",
+                          tracenum);
+            }
+            for (j = index; j < index + trace->ops[i].count; j++)
+                trace->block_sizes[j] = size;
+            total_size += size * trace->ops[i].count;
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            index = trace->ops[i].index;
+            mm_free_batch((void **)&trace->blocks[index], trace->ops[i].count);
+            for (j = index; j < index + trace->ops[i].count; j++)
+                total_size -= trace->block_sizes[j];
+            break;
+
         default:
             app_error("trace %d: Nonexistent request type in eval_mm_util",
                       tracenum);
         }
 
         /* update the high-water mark */
-        max_total_size = (total_size > max_total_size) ?
-            total_size : max_total_size;
+        if (total_size > max_total_size) {
+            max_total_size = total_size;
+            trace->peak_op = i;
+        }
+        if (i == stats_op)
+            mm_get_stats(stats_snapshot);
     }
 
 #if !REF_ONLY
     printf(".");
 #endif
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    /* Mappings outside the heap count towards its size */
+    return ((double)max_total_size / (double)mem_footprint());
 }
 
 
@@ -1284,7 +1482,23 @@ static void eval_mm_speed(void *ptr)
             } else {
                 block = trace->blocks[index];
             }
-            mm_free(block);
+            if (sized_mode)
+                mm_free_sized(block, trace->ops[i].size);
+            else
+                mm_free(block);
+            break;
+
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            index = trace->ops[i].index;
+            if (mm_malloc_batch(trace->ops[i].size, trace->ops[i].count,
+                                (void **)&trace->blocks[index])
+                != (size_t)trace->ops[i].count)
+                app_error("mm_malloc_batch error in eval_mm_speed");
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            index = trace->ops[i].index;
+            mm_free_batch((void **)&trace->blocks[index], trace->ops[i].count);
             break;
 
         default:
@@ -1292,6 +1506,83 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * eval_mm_latency - Runs the trace LATENCY_RUNS times, timing every
+ *    operation, and returns the worst latency in usecs. Each operation
+ *    is charged its fastest time over the runs, so that an interrupt
+ *    during one run does not count as allocator latency.
+ */
+static double eval_mm_latency(trace_t *trace)
+{
+    int i, run, index;
+    struct timespec t0, t1;
+    double ns, worst = 0;
+    double *lat = malloc(trace->num_ops * sizeof(double));
+    char *p;
+
+    if (lat == NULL)
+        unix_error("lat malloc in eval_mm_latency failed");
+    for (i = 0; i < trace->num_ops; i++)
+        lat[i] = DBL_MAX;
+
+    for (run = 0; run < LATENCY_RUNS; run++) {
+        reinit_trace(trace);
+        mem_reset_brk();
+        if (!mm_init())
+            app_error("mm_init failed in eval_mm_latency");
+
+        for (i = 0; i < trace->num_ops; i++) {
+            index = trace->ops[i].index;
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            switch (trace->ops[i].type) {
+            case ALLOC:
+                p = mm_malloc(trace->ops[i].size);
+                break;
+            case REALLOC:
+                p = mm_realloc(trace->blocks[index], trace->ops[i].size);
+                break;
+            case FREE:
+                p = NULL;
+                if (sized_mode)
+                    mm_free_sized(index < 0 ? NULL : trace->blocks[index],
+                                  trace->ops[i].size);
+                else
+                    mm_free(index < 0 ? NULL : trace->blocks[index]);
+                break;
+            case ALLOC_BATCH:
+                if (mm_malloc_batch(trace->ops[i].size, trace->ops[i].count,
+                                    (void **)&trace->blocks[index])
+                    != (size_t)trace->ops[i].count)
+                    app_error("mm_malloc_batch error in eval_mm_latency");
+                p = trace->blocks[index];
+                break;
+            case FREE_BATCH:
+                p = NULL;
+                mm_free_batch((void **)&trace->blocks[index], trace->ops[i].count);
+                break;
+            default:
+                app_error("Nonexistent request type in eval_mm_latency");
+            }
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            if (trace->ops[i].type == ALLOC || trace->ops[i].type == REALLOC) {
+                if (p == NULL && trace->ops[i].size != 0)
+                    app_error("mm_malloc error in eval_mm_latency");
+                trace->blocks[index] = p;
+            }
+
+            ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+            if (ns < lat[i])
+                lat[i] = ns;
+        }
+    }
+
+    for (i = 0; i < trace->num_ops; i++)
+        if (lat[i] > worst)
+            worst = lat[i];
+    free(lat);
+    return worst / 1000.0;
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -1300,7 +1591,7 @@ static void eval_mm_speed(void *ptr)
  */
 static bool eval_libc_valid(trace_t *trace)
 {
-    int i;
+    int i, j;
     size_t newsize;
     char *p, *newp, *oldp;
 
@@ -1335,6 +1626,21 @@ static bool eval_libc_valid(trace_t *trace)
             }
             break;
 
+        case ALLOC_BATCH: /* malloc, once per block */
+            for (j = 0; j < trace->ops[i].count; j++) {
+                if ((p = malloc(trace->ops[i].size)) == NULL) {
+                    malloc_error(trace, i, "libc malloc failed");
+                    unix_error("System message");
+                }
+                trace->blocks[trace->ops[i].index + j] = p;
+            }
+            break;
+
+        case FREE_BATCH: /* free, once per block */
+            for (j = 0; j < trace->ops[i].count; j++)
+                free(trace->blocks[trace->ops[i].index + j]);
+            break;
+
         default:
             app_error("invalid operation type  in eval_libc_valid");
         }
@@ -1350,7 +1656,7 @@ static bool eval_libc_valid(trace_t *trace)
  */
 static void eval_libc_speed(void *ptr)
 {
-    int i;
+    int i, j;
     int index;
     size_t size, newsize;
     char *p, *newp, *oldp, *block;
@@ -1387,6 +1693,21 @@ static void eval_libc_speed(void *ptr)
                 free(0);
             }
             break;
+
+        case ALLOC_BATCH: /* malloc, once per block */
+            index = trace->ops[i].index;
+            for (j = 0; j < trace->ops[i].count; j++) {
+                if ((p = malloc(trace->ops[i].size)) == NULL)
+                    unix_error("malloc failed in eval_libc_speed");
+                trace->blocks[index + j] = p;
+            }
+            break;
+
+        case FREE_BATCH: /* free, once per block */
+            index = trace->ops[i].index;
+            for (j = 0; j < trace->ops[i].count; j++)
+                free(trace->blocks[index + j]);
+            break;
         }
     }
 }
@@ -1409,6 +1730,7 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     double sumops  = 0;
     double sumtput = 0;
     double sumutil = 0;
+    size_t sumsbrks = 0;
     int sum_perf_weight = 0;
     int sum_util_weight = 0;
 
@@ -1417,10 +1739,10 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
 
     /* Print the individual results for each trace */
     if (tab_mode) {
-        printf("valid\tthru?\tutil?\tutil\tops\tmsecs\tKops\ttrace\n");
+        printf("valid\tthru?\tutil?\tutil\tsbrks\tops\tmsecs\tKops\ttrace\n");
     } else {
-        printf("  %5s  %6s %7s%8s%8s  %s\n",
-               "valid", "util", "ops", "msecs", "Kops", "trace");
+        printf("  %5s  %6s %6s %7s%8s%8s  %s\n",
+               "valid", "util", "sbrks", "ops", "msecs", "Kops", "trace");
     }
     for (i=0; i < n; i++) {
         if (stats[i].valid) {
@@ -1458,14 +1780,14 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
 
             /* Utilization */
             if (tab_mode) {
-                printf("%.1f\t", stats[i].util * 100.0);
+                printf("%.1f\t%zu\t", stats[i].util * 100.0, stats[i].sbrks);
             } else {
                 /* print '--' if util isn't weighted */
                 if (stats[i].weight == WNONE || stats[i].weight == WALL
                     || stats[i].weight == WUTIL)
-                    printf(" %7.1f%%", stats[i].util * 100.0);
+                    printf(" %7.1f%% %6zu", stats[i].util * 100.0, stats[i].sbrks);
                 else
-                    printf(" %8s", "--");
+                    printf(" %8s %6s", "--", "--");
             }
 
             /* Ops + Time */
@@ -1496,19 +1818,21 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
                 {
                     sum_util_weight += 1;
                     sumutil += stats[i].util;
+                    sumsbrks += stats[i].sbrks;
                 }
         }
         else {
             if (tab_mode) {
-                printf("no\t\t\t\t\t\t\t%s\n", stats[i].filename);
+                printf("no\t\t\t\t\t\t\t\t%s\n", stats[i].filename);
             } else {
-                printf("%2s%4s%7s%10s%7s%10s %s\n",
+                printf("%2s%4s%7s%7s%10s%7s%10s %s\n",
                        stats[i].weight != 0 ? "*" : "",
                        "no",
                        "-",
                        "-",
                        "-",
                        "-",
+                       "-",
                        stats[i].filename);
             }
         }
@@ -1526,20 +1850,22 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
         if (sparse_mode)
             sumsecs = 0;
         if (tab_mode) {
-            // "valid\tthru?\tutil?\tutil\tops\tmsecs\tKops\ttrace"
-            printf("Sum\t%d\t%d\t%.1f\t%.0f\t\%.2f\n",
+            // "valid\tthru?\tutil?\tutil\tsbrks\tops\tmsecs\tKops\ttrace"
+            printf("Sum\t%d\t%d\t%.1f\t%zu\t%.0f\t\%.2f\n",
                    sum_perf_weight,
                    sum_util_weight,
                    sumutil * 100.0,
+                   sumsbrks,
                    sumops,
                    sumsecs * 1000.0);
-            printf("Avg\t\t\t%.1f\t\t\t\n",
+            printf("Avg\t\t\t%.1f\t\t\t\t\n",
                    util * 100.0);
         } else {
-            printf("%2d %2d  %7.1f%%%8.0f%10.3f\n",
+            printf("%2d %2d  %7.1f%% %6zu%8.0f%10.3f\n",
                    sum_util_weight,
                    sum_perf_weight,
                    util * 100.0,
+                   sumsbrks,
                    sumops,
                    sumsecs * 1000.0);
         }
@@ -1553,7 +1879,7 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     }
     else {
         if (!tab_mode) {
-            printf("     %8s%10s%7s\n",
+            printf("            %8s%10s%7s\n",
                    "-",
                    "-",
                    "-");
@@ -1684,6 +2010,112 @@ static char *gen_file_name(char *template, char *buf, int maxlen) {
     return lim > 0 ? buf : NULL;
 }
 
+/*
+ * printlatency - prints the worst per-operation latency of each engine
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    int i, e;
+
+    printf("Worst operation latency (usecs):\n");
+    for (e = 0; e < num_engines; e++)
+        printf("  engine=%d", e);
+    printf("  trace\n");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        for (e = 0; e < num_engines; e++)
+            printf("%10.2f", stats[i].maxlat[e]);
+        printf("  %s\n", stats[i].filename);
+    }
+}
+
+/*
+ * printorders - prints the util and throughput of each trace with every
+ *     class list in each free list order, and their averages
+ */
+static void printorders(int n, stats_t *stats)
+{
+    int i, o, valid = 0;
+    double util[MAX_ORDERS] = {0}, tput[MAX_ORDERS] = {0};
+
+    printf("Util and throughput (Kops/s) by free list order:\n");
+    for (o = 0; o < num_orders; o++)
+        printf("       order=%d", o);
+    printf("  trace\n");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        for (o = 0; o < num_orders; o++) {
+            printf("%6.1f%%%8.0f", stats[i].order_util[o] * 100.0,
+                   stats[i].order_tput[o]);
+            util[o] += stats[i].order_util[o];
+            tput[o] += stats[i].order_tput[o];
+        }
+        printf("  %s\n", stats[i].filename);
+        valid++;
+    }
+    if (valid == 0)
+        return;
+    for (o = 0; o < num_orders; o++)
+        printf("%6.1f%%%8.0f", util[o] * 100.0 / valid, tput[o] / valid);
+    printf("  Avg\n");
+}
+
+/*
+ * printallocstats - prints the allocator statistics of each trace: the
+ *     search, coalescing and growth counts over the whole trace, and the
+ *     free lists and the use of the heap at its peak of live data
+ */
+static void printallocstats(int n, stats_t *stats)
+{
+    int i, c;
+    mm_stats_t *end, *peak;
+    unsigned long fits;
+    size_t free_bytes;
+    double heap;
+
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        end = &stats[i].alloc_end;
+        peak = &stats[i].alloc_peak;
+        printf("Allocator statistics for %s:\n", stats[i].filename);
+        printf("%8s%12s%12s%12s%14s%14s\n", "class", "fit hits", "misses",
+               "visits/fit", "peak blocks", "peak bytes");
+        free_bytes = 0;
+        for (c = 0; c < MM_STATS_CLASSES; c++) {
+            if (c == 0)
+                printf("%8s", "mini");
+            else
+                printf("%8d", c - 1);
+            fits = end->fit_hits[c] + end->fit_misses[c];
+            printf("%12lu%12lu%12.1f%14lu%14zu\n", end->fit_hits[c],
+                   end->fit_misses[c],
+                   fits ? (double)end->fit_visited[c] / fits : 0.0,
+                   peak->free_blocks[c], peak->free_bytes[c]);
+            free_bytes += peak->free_bytes[c];
+        }
+        if (stats[i].alloc_counted) {
+            printf("THRESHFIT cutoffs %lu; coalesce: alone %lu, next %lu, "
+                   "prev %lu, both %lu\n", end->fit_cutoffs,
+                   end->coalesce[0], end->coalesce[1], end->coalesce[2],
+                   end->coalesce[3]);
+            printf("place: split %lu, whole %lu; extend_heap: %lu calls, "
+                   "%lu bytes\n", end->place_split, end->place_whole,
+                   end->extend_calls, end->extend_bytes);
+        } else {
+            printf("Event counters not built in (make clean; make STATS=1)\n");
+        }
+        heap = peak->heap_bytes ? (double)peak->heap_bytes / 100.0 : 1.0;
+        printf("At peak: heap %zu bytes = payload %.1f%% + metadata %.1f%% + "
+               "idle %.1f%% + free %.1f%%; mapped %zu bytes\n\n",
+               peak->heap_bytes, peak->payload_bytes / heap,
+               peak->metadata_bytes / heap, peak->idle_bytes / heap,
+               free_bytes / heap, peak->mapped_bytes);
+    }
+}
+
 /*
  * usage - Explain the command line arguments
  */
@@ -1703,4 +2135,9 @@ static void usage(char *prog)
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
     fprintf(stderr, "\t-T         Print diagnostics in tab mode\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file\n");
+    fprintf(stderr, "\t-o <n>=<v> Set allocator option <n> to <v> (e.g. slab=0)\n");
+    fprintf(stderr, "\t-L         Report the worst per-op latency of each engine\n");
+    fprintf(stderr, "\t-P         Report util and throughput under each free list order\n");
+    fprintf(stderr, "\t-z         Free with mm_free_sized\n");
+    fprintf(stderr, "\t-S         Print allocator statistics for each trace\n");
 }
@@ -4,7 +4,11 @@
  * package with the system's malloc package in libc.
  *
  * This version has been updated to enable sparse emulation of very large heaps
+ *
+ * The heap is backed by a memfd where the system has one, so that
+ * mem_remap can move pages between heap addresses without copying them.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -26,8 +30,25 @@ static unsigned char *mem_max_addr;         /* Maximum allowable heap address */
 static size_t mmap_length = MAX_DENSE_HEAP; /* Number of bytes allocated by mmap */
 static bool show_stats = false;             /* Should program print allocation information? */
 static bool stats_printed = false;          /* Has information been printed about allocation */
+static int heap_fd = -1;                    /* memfd behind the heap, -1 if none */
+static uint32_t page_file[MAX_DENSE_HEAP / REMAP_PAGE]; /* File page behind each heap page */
+static size_t remap_hi = 0;                 /* Heap pages below this may be remapped */
+static struct {
+    unsigned char *addr;
+    size_t len;
+} maps[MAX_MAPS];                           /* Live mappings made by mem_map */
+static size_t map_count = 0;                /* Number of live mappings */
+static size_t mapped_bytes = 0;             /* Bytes in live mappings */
+static size_t footprint = 0;                /* Peak of heap plus mapped bytes */
+static unsigned char *fresh_brk;            /* Highest break since mem_init */
+static size_t sbrk_calls = 0;               /* Successful mem_sbrk calls since the last reset */
 
 static void print_stats();
+static void move_pages(unsigned char *to, unsigned char *from,
+                       const uint32_t *file, size_t count);
+static void unscramble(void);
+static void note_footprint(void);
+static size_t find_map(const void *addr);
 
 /* 
  * mem_init - initialize the memory system model
@@ -36,14 +57,34 @@ void mem_init(){
     /* Dense allocation */
     mmap_length = MAX_DENSE_HEAP;
 
-    int dev_zero = open("/dev/zero", O_RDWR);
     void *start = TRY_DENSE_HEAP_START;
-    void *addr = mmap(start,        /* suggested start*/
-                      mmap_length,  /* length */
-                      PROT_WRITE,   /* permissions */
-                      MAP_PRIVATE,  /* private or shared? */
-                      dev_zero,            /* fd */
-                      0);            /* offset */
+    void *addr = MAP_FAILED;
+
+    /* Prefer a memfd, whose pages mem_remap can rearrange */
+    heap_fd = memfd_create("mm-heap", MFD_CLOEXEC);
+    if (heap_fd >= 0 && (sysconf(_SC_PAGESIZE) != REMAP_PAGE ||
+                         ftruncate(heap_fd, mmap_length) != 0)) {
+        close(heap_fd);
+        heap_fd = -1;
+    }
+    if (heap_fd >= 0) {
+        addr = mmap(start, mmap_length, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, heap_fd, 0);
+        if (addr == MAP_FAILED) {
+            close(heap_fd);
+            heap_fd = -1;
+        }
+    }
+    if (addr == MAP_FAILED) {
+        int dev_zero = open("/dev/zero", O_RDWR);
+        addr = mmap(start,        /* suggested start*/
+                    mmap_length,  /* length */
+                    PROT_WRITE,   /* permissions */
+                    MAP_PRIVATE,  /* private or shared? */
+                    dev_zero,            /* fd */
+                    0);            /* offset */
+        close(dev_zero);
+    }
     if (addr == MAP_FAILED) {
         fprintf(stderr, "FAILURE.  mmap couldn't allocate space for heap\n");
         exit(1);
@@ -51,9 +92,13 @@ void mem_init(){
     
     heap = addr;
     mem_max_addr = heap + MAX_DENSE_HEAP;
+    for (size_t i = 0; i < MAX_DENSE_HEAP / REMAP_PAGE; i++)
+        page_file[i] = i;
+    remap_hi = 0;
     
     stats_printed = false;
     mem_brk = heap;
+    fresh_brk = heap;
     mem_reset_brk();
 }
 
@@ -62,7 +107,12 @@ void mem_init(){
  */
 void mem_deinit(void){
     print_stats();
+    mem_reset_brk();
     munmap(heap, mmap_length);
+    if (heap_fd >= 0) {
+        close(heap_fd);
+        heap_fd = -1;
+    }
 }
 
 /*
@@ -71,6 +121,14 @@ void mem_deinit(void){
 void mem_reset_brk(){
     print_stats();
     mem_brk = heap;
+    unscramble();
+    /* Mappings belong to the heap that is being thrown away */
+    for (size_t i = 0; i < map_count; i++)
+        munmap(maps[i].addr, maps[i].len);
+    map_count = 0;
+    mapped_bytes = 0;
+    footprint = 0;
+    sbrk_calls = 0;
 }
 
 /* 
@@ -95,6 +153,10 @@ void *mem_sbrk(intptr_t incr) {
     }
     if (ok) {
         mem_brk += incr;
+        if (mem_brk > fresh_brk)
+            fresh_brk = mem_brk;
+        sbrk_calls++;
+        note_footprint();
         return (void *) old_brk;
     } else {
         errno = ENOMEM;
@@ -102,6 +164,14 @@ void *mem_sbrk(intptr_t incr) {
     }
 }
 
+/*
+ * mem_sbrk_calls - return the number of successful mem_sbrk calls since
+ *                  the heap was last reset
+ */
+size_t mem_sbrk_calls(void) {
+    return sbrk_calls;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -123,6 +193,134 @@ size_t mem_heapsize() {
     return (size_t)(mem_brk - heap);
 }
 
+/*
+ * mem_heap_fresh - return the lowest heap address that mem_sbrk has not
+ *                  handed out since mem_init. The heap from there up still
+ *                  reads as zero; mem_reset_brk does not clear the rest.
+ */
+void *mem_heap_fresh(void) {
+    return (void *)fresh_brk;
+}
+
+/*
+ * mem_remap - swaps the contents of two disjoint, page-aligned ranges of
+ *             len bytes in the heap by exchanging the file pages behind
+ *             them; nothing is copied. Returns false, changing nothing, if
+ *             the heap has no memfd or the ranges do not qualify.
+ */
+bool mem_remap(void *dst, void *src, size_t len) {
+    size_t d = ((unsigned char *)dst - heap) / REMAP_PAGE;
+    size_t s = ((unsigned char *)src - heap) / REMAP_PAGE;
+    size_t n = len / REMAP_PAGE;
+    unsigned char *scratch;
+    uint32_t t;
+
+    if (heap_fd < 0 || len == 0 || len % REMAP_PAGE != 0 ||
+        (unsigned char *)dst < heap || (unsigned char *)src < heap ||
+        ((unsigned char *)dst - heap) % REMAP_PAGE != 0 ||
+        ((unsigned char *)src - heap) % REMAP_PAGE != 0 ||
+        (unsigned char *)dst + len > mem_brk ||
+        (unsigned char *)src + len > mem_brk ||
+        (d < s + n && s < d + n))
+        return false;
+
+    /* Rotate the mappings through a scratch range, so that both sides
+       keep their page tables and nothing faults afterwards */
+    scratch = mmap(NULL, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (scratch == MAP_FAILED)
+        return false;
+    move_pages(scratch, dst, &page_file[d], n);
+    move_pages(dst, src, &page_file[s], n);
+    move_pages(src, scratch, &page_file[d], n);
+    munmap(scratch, len);
+
+    for (size_t i = 0; i < n; i++) {
+        t = page_file[d + i];
+        page_file[d + i] = page_file[s + i];
+        page_file[s + i] = t;
+    }
+    if (remap_hi < d + n)
+        remap_hi = d + n;
+    if (remap_hi < s + n)
+        remap_hi = s + n;
+    return true;
+}
+
+/*
+ * mem_map - maps len bytes, a multiple of the page size, outside the heap.
+ *           Returns the page-aligned start, or NULL on failure.
+ */
+void *mem_map(size_t len) {
+    void *addr;
+
+    if (len == 0 || len % mem_pagesize() != 0 || map_count == MAX_MAPS)
+        return NULL;
+    addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+        return NULL;
+    maps[map_count].addr = addr;
+    maps[map_count].len = len;
+    map_count++;
+    mapped_bytes += len;
+    note_footprint();
+    return addr;
+}
+
+/*
+ * mem_mremap - resizes a mapping made by mem_map to new_len bytes, moving
+ *              it if need be; the pages are moved, not copied.
+ *              Returns the new start, or NULL leaving the mapping as it was.
+ */
+void *mem_mremap(void *addr, size_t new_len) {
+    size_t i = find_map(addr);
+    void *moved;
+
+    if (i == map_count || new_len == 0 || new_len % mem_pagesize() != 0)
+        return NULL;
+    moved = mremap(addr, maps[i].len, new_len, MREMAP_MAYMOVE);
+    if (moved == MAP_FAILED)
+        return NULL;
+    mapped_bytes += new_len - maps[i].len;
+    maps[i].addr = moved;
+    maps[i].len = new_len;
+    note_footprint();
+    return moved;
+}
+
+/*
+ * mem_unmap - returns the pages of a mapping made by mem_map at once.
+ */
+void mem_unmap(void *addr) {
+    size_t i = find_map(addr);
+
+    if (i == map_count)
+        return;
+    munmap(addr, maps[i].len);
+    mapped_bytes -= maps[i].len;
+    maps[i] = maps[--map_count];
+}
+
+/*
+ * mem_is_mapped - returns true if the bytes from lo to hi lie within one
+ *                 live mapping made by mem_map.
+ */
+bool mem_is_mapped(const void *lo, const void *hi) {
+    for (size_t i = 0; i < map_count; i++)
+        if ((const unsigned char *)lo >= maps[i].addr &&
+            (const unsigned char *)hi < maps[i].addr + maps[i].len)
+            return true;
+    return false;
+}
+
+/*
+ * mem_footprint - returns the peak of the heap size plus the bytes in
+ *                 live mappings since the heap was last reset
+ */
+size_t mem_footprint(void) {
+    return footprint;
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
@@ -133,6 +331,53 @@ size_t mem_pagesize(){
 
 /*************** Private Functions *******************/
 
+/*
+ * note_footprint - raises the footprint to the current heap plus mappings
+ */
+static void note_footprint(void) {
+    size_t now = mem_heapsize() + mapped_bytes;
+    if (now > footprint)
+        footprint = now;
+}
+
+/*
+ * find_map - returns the index of the mapping that starts at addr, or
+ *            map_count if there is none
+ */
+static size_t find_map(const void *addr) {
+    size_t i;
+    for (i = 0; i < map_count && maps[i].addr != addr; i++)
+        ;
+    return i;
+}
+
+/*
+ * move_pages - moves the mappings of count heap pages, backed by the file
+ *              pages listed in file, from from to to. mremap hands the page
+ *              tables over without touching the pages; a run that spans
+ *              several mappings is mapped afresh at to instead.
+ */
+static void move_pages(unsigned char *to, unsigned char *from,
+                       const uint32_t *file, size_t count) {
+    size_t run;
+    void *addr;
+
+    for (size_t i = 0; i < count; i += run) {
+        for (run = 1; i + run < count && file[i + run] == file[i] + run; run++)
+            ;
+        addr = mremap(from + i * REMAP_PAGE, run * REMAP_PAGE, run * REMAP_PAGE,
+                      MREMAP_MAYMOVE | MREMAP_FIXED, to + i * REMAP_PAGE);
+        if (addr == MAP_FAILED)
+            addr = mmap(to + i * REMAP_PAGE, run * REMAP_PAGE,
+                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                        heap_fd, (off_t)file[i] * REMAP_PAGE);
+        if (addr == MAP_FAILED) {
+            fprintf(stderr, "FAILURE.  mmap couldn't remap heap pages\n");
+            exit(1);
+        }
+    }
+}
+
 
 static void print_stats() {
     size_t vbytes = mem_heapsize();
@@ -143,6 +388,42 @@ static void print_stats() {
     stats_printed = true;
 }
 
+/*
+ * unscramble - puts every remapped heap page back on its own file page, so
+ *              that runs of mem_remap do not fragment the heap mapping
+ *              without bound. The runs of pages are sorted through a
+ *              scratch range by mremap, keeping their page tables.
+ */
+static void unscramble(void) {
+    size_t len = remap_hi * REMAP_PAGE, run;
+    unsigned char *scratch;
+
+    if (remap_hi == 0)
+        return;
+    scratch = mmap(NULL, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (scratch == MAP_FAILED) {
+        fprintf(stderr, "FAILURE.  mmap couldn't restore heap pages\n");
+        exit(1);
+    }
+    /* Runs go to their file offset in scratch, then straight back */
+    for (size_t i = 0; i < remap_hi; i += run) {
+        for (run = 1; i + run < remap_hi && page_file[i + run] == page_file[i] + run; run++)
+            ;
+        move_pages(scratch + (size_t)page_file[i] * REMAP_PAGE,
+                   heap + i * REMAP_PAGE, &page_file[i], run);
+    }
+    for (size_t i = 0; i < remap_hi; i += run) {
+        for (run = 1; i + run < remap_hi && page_file[i + run] == page_file[i] + run; run++)
+            ;
+        move_pages(heap + (size_t)page_file[i] * REMAP_PAGE,
+                   scratch + (size_t)page_file[i] * REMAP_PAGE, &page_file[i], run);
+    }
+    munmap(scratch, len);
+    for (size_t i = 0; i < remap_hi; i++)
+        page_file[i] = i;
+    remap_hi = 0;
+}
+
 uint64_t mem_read(const void *addr, size_t len) {
     uint64_t rdata;
 
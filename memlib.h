@@ -5,11 +5,19 @@
 void mem_init();               
 void mem_deinit(void);
 void *mem_sbrk(intptr_t incr);
+size_t mem_sbrk_calls(void);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+void *mem_heap_fresh(void);
 size_t mem_pagesize(void);
+bool mem_remap(void *dst, void *src, size_t len);
+void *mem_map(size_t len);
+void *mem_mremap(void *addr, size_t new_len);
+void mem_unmap(void *addr);
+bool mem_is_mapped(const void *lo, const void *hi);
+size_t mem_footprint(void);
 
 /* Read len bytes and return value zero-extended to 64 bits */
 /* Require 0 <= len <= 8 */
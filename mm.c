@@ -19,6 +19,9 @@
 #include <stddef.h>
 #include <assert.h>
 #include <stddef.h>
+#include <time.h>
+#include <sched.h>
+#include <errno.h>
 
 #include "mm.h"
 #include "memlib.h"
@@ -29,6 +32,13 @@
 #define free mm_free
 #define realloc mm_realloc
 #define calloc mm_calloc
+#define malloc_batch mm_malloc_batch
+#define free_batch mm_free_batch
+#define free_sized mm_free_sized
+#define malloc_usable mm_malloc_usable
+#define memalign mm_memalign
+#define posix_memalign mm_posix_memalign
+#define aligned_alloc mm_aligned_alloc
 #endif /* def DRIVER */
 
 /* You can change anything from here onward */
@@ -38,7 +48,7 @@
  * Debugging macros, with names beginning "dbg_" are allowed.
  * You may not define any other macros having arguments.
  */
-#define DEBUG // uncomment this line to enable debugging
+// #define DEBUG // uncomment this line to enable debugging
 
 #ifdef DEBUG
 /* When debugging is enabled, these form aliases to useful functions */
@@ -56,10 +66,98 @@
 
 #define LISTSIZE 12
 #define THRESHFIT 20
+#define TREE_CLASS (LISTSIZE - 1) // the largest class is a size-ordered treap
 #define NEXTBLOCK block->payload.links.next
-#define PREVBLOCK block->payload.links.prev
 #define ABIT 0x2
-#define SBIT 0x4
+#define LBIT 0x8          // block is linked into a free list
+#define TCACHE_BINS 7     // mini list + classes 0..5 (blocks up to 1 KB)
+#define TCACHE_COUNT 8    // blocks a bin may hold before it is flushed
+#define TCACHE_REFILL 4   // exact fits pulled from the lists on a miss
+#define FAST_MAX 512      // largest block size kept in an arena's fastbins
+#define FAST_BINS (FAST_MAX / 16) // one fastbin per block size, from 16 bytes
+#define ARENAS 4          // independent heaps threads are spread over
+#define PAGE_SHIFT 12     // granularity of the page -> arena map
+#define HEAP_PAGES (1 << 16) // pages covered by the map (256 MB of heap)
+#define SLAB_CLASSES 16   // slab object sizes 16, 32, ..., 256
+#define SLAB_MAX (SLAB_CLASSES * 16) // largest request served by a slab
+#define SLAB_RUN ((1 << PAGE_SHIFT) - 8) // a run fills its page up to the next header
+#define SLAB_HEADER 64    // run header, objects start after it
+#define PAGE_SLAB 0x80    // page_arena flag: the page is a slab run
+#define PAGE_BUDDY 0x40   // page_arena flag: the page is in a buddy zone
+#define PAGE_ARENA 0x3f   // page_arena bits holding the arena id
+#define BUDDY_MIN_ORDER 5 // smallest buddy block, 32 bytes
+#define BUDDY_ZONE_ORDER 20 // buddy zones are 1 MB, aligned to their size
+#define BUDDY_FREE 0x100  // buddy tag flag, the low byte is the order
+#define GROW_LOCK (LISTSIZE + 1)
+#define TLSF_SL_SHIFT 4   // TLSF: each power of two is split in 16 lists
+#define TLSF_SL (1 << TLSF_SL_SHIFT)
+#define TLSF_FL 32        // TLSF: first-level classes, heap below 4 GB
+#define BUDDY_LOCK (GROW_LOCK + 1 + SLAB_CLASSES)
+#define FAST_LOCK (BUDDY_LOCK + 1)
+#define LOCKS (FAST_LOCK + 1) // per arena: mini list, each class, growth, each slab class, buddy, fastbins
+#define LOCK_SPINS 64     // busy-wait rounds before yielding the CPU
+#define BATCH_SORT 64     // pointers free_batch sorts at a time
+#define MAP_SLOTS 1024    // side table of direct-mapped blocks, a power of two
+#define REMOTE_DRAIN 64   // queued remote frees that make the freeing thread drain
+#define CHECK_BUDGET 2    // blocks mm_checkheap examines per call, on each of its walks
+#define GROW_OVERSHOOT 1  // percent of the heap a heap extension may add beyond the request
+#define EXACT_SLOTS 16    // exact-size index slots per size class, a power of two
+#define EXACT_NONE 1      // same_prev of a free block left out of the exact-size index
+#define PACK_SLOTS 64     // leading blocks of each class list whose sizes are packed
+#define PACK_VEC 4        // lanes of a packed-size vector, one SSE2 register (pack_fit lists them)
+#define PACK_MID 0x80000000u // list rank that packed ranks spread from, both ways
+
+/*
+ * Locking modes, selected at build time with -DLOCKING=<mode>:
+ * LOCK_NONE   single-threaded use only
+ * LOCK_GLOBAL one lock around every shared-heap operation
+ * LOCK_FINE   per-arena locks on each size class, the mini list and
+ *             heap growth; headers are updated with atomic operations
+ * The per-thread caches keep most calls off the locks either way. LOCK_FINE
+ * pays for its atomic header updates even when uncontended, so it only wins
+ * when several threads miss their caches at once.
+ */
+#define LOCK_NONE 0
+#define LOCK_GLOBAL 1
+#define LOCK_FINE 2
+#ifndef LOCKING
+#define LOCKING LOCK_GLOBAL
+#endif
+
+/*
+ * Event counters for mm_get_stats (searches, coalescing, splits, growth),
+ * built in with -DSTATS=1; otherwise every count compiles to nothing.
+ */
+#ifndef STATS
+#define STATS 0
+#endif
+
+/*
+ * Free list engines for blocks larger than 16 bytes, selected with the
+ * "engine" option; the choice takes effect at the next mm_init.
+ * ENGINE_SEGLIST LISTSIZE power-of-two classes, best of THRESHFIT candidates;
+ *                blocks of TREE_CLASS sit in a treap instead, for an exact
+ *                best fit in O(log n)
+ * ENGINE_TLSF    two-level segregated fit: a first-level bitmap over powers
+ *                of two and a second-level bitmap over TLSF_SL sub-ranges;
+ *                search, insert and delete are O(1)
+ */
+#define ENGINE_SEGLIST 0
+#define ENGINE_TLSF 1
+
+/*
+ * Orders of the ENGINE_SEGLIST class lists below TREE_CLASS, set per class
+ * with the "order" options; the choice takes effect at the next mm_init.
+ * ORDER_LIFO a freed block goes to the head of its list and is reused
+ *            first; only these classes keep the exact-size index
+ * ORDER_FIFO a freed block goes to the tail and waits the longest
+ * ORDER_ADDR the list is kept in address order, so fits come from the
+ *            low end of the heap; a treap over the class's blocks, keyed
+ *            by address, finds where a freed block goes in O(log n)
+ */
+#define ORDER_LIFO 0
+#define ORDER_FIFO 1
+#define ORDER_ADDR 2
 //#define checkheap(...) mm_checkheap(__VA_ARGS__)
 //#define checkheap(...)  
 
@@ -67,7 +165,7 @@
 typedef uint64_t word_t;
 static const size_t wsize = sizeof(word_t);   // word and header size (bytes)
 static const size_t dsize = 2*sizeof(word_t);       // double word size (bytes)
-static const size_t min_block_size = 4*sizeof(word_t); // Minimum block size
+static const size_t min_block_size = 2*sizeof(word_t); // Minimum block size, a mini block
 static const size_t chunksize = (1 << 12);    // requires (chunksize % 16 == 0)
 
 static const word_t alloc_mask = 0x1;
@@ -79,15 +177,27 @@ typedef struct block block_t;
  * 1. Size 
  * 2. Allocation flag
  * 3. Check previous allocation flag
- * 4. Check previous small block flag
  *
  * Payload contains:
  * a. If allocated: only data
- * b. If unallocated and size > 16 bytes:
- *    1. Pointer to next block in segregated free list
- *    2. Pointer to previous block in segregated free list 
- * c. If unallocated and size <= 16 bytes:
- *    1. Pointer to next block in small free list
+ * b. If unallocated and linked into a free list (the small blocks list,
+ *    a segregated class, a TLSF list or a buddy order):
+ *    1. Offset from the heap start of the next block in the list
+ *    2. Offset from the heap start of the previous block in the list
+ *    Two 32-bit offsets fit the 8-byte payload of a 16-byte block, so every
+ *    doubly linked list shares one layout; 0 ends the list.
+ *    A block of an ORDER_LIFO class below TREE_CLASS goes on in its third
+ *    word with the offsets of the next and previous block of its exact
+ *    size in its arena's exact-size index, or EXACT_NONE if it is not
+ *    indexed. In an ORDER_ADDR class that word holds the offsets of its
+ *    left and right children in the class's address treap instead.
+ * c. If unallocated and in TREE_CLASS: pointers to the left and right
+ *    children in the treap
+ * A free block ends with a footer holding its size, by which the next block
+ * finds it. In a 16-byte (mini) block the footer is the payload word, which
+ * its list links overwrite; footer_size tells the two apart.
+ * Blocks on the singly linked caches (tcache, fastbins, remote queues) keep
+ * a full pointer to the next block in the first payload word.
  */
  
 struct block
@@ -106,6 +216,25 @@ struct block
             block_t *next;
             block_t *prev;
         }links;
+        struct
+        {
+            block_t *left;
+            block_t *right;
+        }tree;
+        struct
+        {
+            uint32_t next;
+            uint32_t prev;
+            uint32_t same_next;
+            uint32_t same_prev;
+        }link;
+        struct
+        {
+            uint32_t next;
+            uint32_t prev;
+            uint32_t left;
+            uint32_t right;
+        }addr;
         char data[0];
     /*
      * We can't declare the footer as part of the struct, since its starting
@@ -122,24 +251,246 @@ struct block
 // Total size = 8 + 12*8 + 8 = 112 bytes
 
 static block_t *heap_start = NULL;
-/* Array of pointers for segregated list */
-static block_t *listHeader[LISTSIZE];
-/* Header for List of small blocks */
-static block_t *smallListHeader = NULL;
+/* Bumped by mm_init so that stale per-thread caches are discarded */
+static unsigned long heap_gen = 0;
+
+/* Arena Structure:
+ * Each arena is an independent heap with its own segregated lists.
+ * An arena grows by mem_sbrk in segments; a segment is extended in
+ * place while it still ends at the break, otherwise a new page-aligned
+ * segment is opened with its own prologue footer and end header.
+ * Blocks never coalesce across segments.
+ * The free block that ends the newest segment is the arena's top (the
+ * wilderness). It sits on no list: allocations are cut off its front only
+ * when no listed block fits, and the heap grows by growing it.
+ */
+/* Spin lock with contention counters:
+ * The counters are only updated by the holder, so they need no atomics.
+ */
+typedef struct lock
+{
+    int held;
+    unsigned long acquired;   // number of acquisitions
+    unsigned long contended;  // acquisitions that had to wait
+    unsigned long wait_ns;    // total time spent waiting
+} lock_t;
+
+/* Exact-size index slot: the block size it holds, and the offset of the
+ * first free block of that size, 0 while the slot is free */
+typedef struct exact
+{
+    uint32_t size;
+    uint32_t head;
+} exact_t;
+
+/* Vector of PACK_VEC packed sizes or offsets (GCC vector extension) */
+typedef int32_t pack_vec_t __attribute__((vector_size(PACK_VEC * sizeof(int32_t))));
+/* Vector of PACK_VEC list ranks: the lower rank comes first in the list */
+typedef uint32_t pack_rank_t __attribute__((vector_size(PACK_VEC * sizeof(uint32_t))));
+_Static_assert(sizeof(pack_vec_t) % sizeof(uint64_t) == 0, "pack_find tests a pack_vec_t in 64-bit words");
+
+typedef struct arena
+{
+    /* Array of pointers for segregated list */
+    block_t *listHeader[LISTSIZE]; // the root of the treap for TREE_CLASS
+    /* Header for List of small blocks */
+    block_t *smallListHeader;
+    /* ENGINE_SEGLIST: the free blocks of each ORDER_LIFO class below
+     * TREE_CLASS, hashed on their size into chains of a single size */
+    exact_t exact[TREE_CLASS][EXACT_SLOTS];
+    /* Last block of each ORDER_FIFO class list */
+    block_t *listTail[TREE_CLASS];
+    /* Offset of the root of each ORDER_ADDR class's address treap */
+    uint32_t addrRoot[TREE_CLASS];
+    /* ENGINE_SEGLIST: sizes and offsets of the first pack_count blocks of
+     * each class list below TREE_CLASS, in no particular order and zero
+     * past the count, so find_fit compares them with vector operations
+     * instead of visiting the blocks. The blocks past pack_last are loose:
+     * there are only any while the arrays are full. Each entry has a rank
+     * that orders it as the list does: its offset in an ORDER_ADDR list,
+     * else one below pack_front for a new head and one above pack_back
+     * for a block packed at the end. */
+    pack_vec_t pack_size[TREE_CLASS][PACK_SLOTS / PACK_VEC];
+    pack_vec_t pack_off[TREE_CLASS][PACK_SLOTS / PACK_VEC];
+    pack_rank_t pack_rank[TREE_CLASS][PACK_SLOTS / PACK_VEC];
+    uint32_t pack_front[TREE_CLASS];
+    uint32_t pack_back[TREE_CLASS];
+    int pack_count[TREE_CLASS];
+    block_t *pack_last[TREE_CLASS];
+    unsigned long pack_loose[TREE_CLASS];
+    /* End header of the newest segment, NULL before the first one */
+    block_t *epilogue;
+    /* Free block right before that end header, on no list, or NULL */
+    block_t *top;
+    /* Nothing from here to the end header has been handed out: it reads
+     * as zero, but for the header and links of the free block at this
+     * address and the footer before the end header */
+    char *fresh;
+    unsigned char id;
+    /* ENGINE_TLSF: lists by first and second level, with their bitmaps */
+    unsigned int tlsf_fl;
+    unsigned int tlsf_sl[TLSF_FL];
+    block_t *tlsf[TLSF_FL][TLSF_SL];
+    /* Slab runs with at least one free object, per slab class */
+    struct slab *slabs[SLAB_CLASSES];
+    /* Requests of each slab class served by regular blocks so far; the
+     * class takes slab runs once a run's worth of them has come */
+    unsigned long slab_warm[SLAB_CLASSES];
+    /* Free buddy blocks by order, and the orders that have any */
+    block_t *buddy[BUDDY_ZONE_ORDER + 1];
+    unsigned int buddy_map;
+    /* The heap could not grow for a zone: new zones come from free space
+     * only, and requests that find none take regular blocks */
+    bool buddy_full;
+    /* Blocks spilled from full thread caches, by exact size; still marked
+     * allocated, so nothing coalesces with them until fast_consolidate */
+    block_t *fast[FAST_BINS];
+    unsigned long fast_count;
+    /* Growth policy: the step of the last heap extension, the bytes freed
+     * in the arena since, and whether it came under allocation pressure */
+    size_t grow_step;
+    size_t grow_freed;
+    bool grow_hot;
+    /* LOCK_FINE: [0] mini list, [1 + i] class i, [GROW_LOCK] growth,
+     * [GROW_LOCK + 1 + c] slab class c, [BUDDY_LOCK] buddy lists,
+     * [FAST_LOCK] fastbins */
+    lock_t locks[LOCKS];
+    /* Blocks freed by threads of other arenas: an intrusive MPSC queue,
+     * pushed with one exchange and popped by the thread holding remote_lock */
+    block_t *remote_head;     // newest block, swapped in by producers
+    block_t *remote_tail;     // oldest block, only touched by the consumer
+    block_t remote_stub;      // keeps the queue non-empty
+    unsigned long remote_count;
+    lock_t remote_lock;
+} arena_t;
+
+static arena_t arenas[ARENAS];
+/* Next arena handed to a thread, round-robin */
+static unsigned int arena_next = 0;
+/* Address of the first heap byte, base of the page map */
+static char *heap_lo = NULL;
+/* Slab run: the payload of a 4 KB heap block that starts on a page
+ * boundary, holding objects of a single size with no per-object header.
+ * free finds the run by rounding the object address down to its page.
+ * Runs carved at the end of the heap follow each other with no gap.
+ */
+typedef struct slab
+{
+    struct slab *next;        // partial runs of the same class
+    struct slab *prev;
+    unsigned short osize;     // object size
+    unsigned short nslots;
+    unsigned short nfree;
+    unsigned char cls;
+    unsigned long map[4];     // one bit per slot, set if the slot is free
+} slab_t;
+
+/* Buddy block: a power-of-two block inside a buddy zone, aligned to its
+ * size. Its first word is a tag holding the order, plus BUDDY_FREE while
+ * it is free; the payload starts 16 bytes in. A free block's buddy is found
+ * by flipping the order bit of its address, so no footer is needed.
+ */
+
+/* Owning arena of every heap page, so free can route a block home,
+ * or'ed with PAGE_SLAB for pages holding a slab run and with PAGE_BUDDY
+ * for pages of a buddy zone */
+static unsigned char page_arena[HEAP_PAGES];
+/* Serve requests of up to SLAB_MAX bytes from slab runs (option "slab") */
+static bool slab_enabled = true;
+/* Requests of at least this many bytes are buddy blocks, 0 for none (option "buddy") */
+static size_t buddy_min = 0;
+/* Payloads realloc moves to at least this many bytes are page-aligned, so
+ * that their later moves swap pages with mem_remap, 0 for never (option
+ * "remap"). It sits below mmap_min: past that, mappings are resized by
+ * mem_mremap instead */
+static size_t remap_min = 1 << 16;
+/* Requests of at least this many bytes get their own mapping outside the
+ * heap, 0 for never (option "mmap") */
+static size_t mmap_min = 1 << 18;
+/* Heap extensions grow geometrically under allocation pressure, by at most
+ * this percent of the heap; 0 for chunksize steps (option "grow") */
+static size_t grow_overshoot = GROW_OVERSHOOT;
+
+/* Direct-mapped block: a page-granular mem_map mapping whose start is the
+ * payload. The side table maps its page number to its size, by open
+ * addressing, so free and realloc find it in O(1).
+ */
+typedef struct
+{
+    char *start;
+    size_t size;
+} mapping_t;
+
+static mapping_t mappings[MAP_SLOTS];
+static size_t mapping_count;
+/* Free list engine in use, and the one mm_init switches to (option "engine") */
+static int engine = ENGINE_SEGLIST;
+static int engine_next = ENGINE_SEGLIST;
+/* Order of each class list in use, and the ones mm_init switches to (options "order") */
+static unsigned char order[TREE_CLASS];
+static unsigned char order_next[TREE_CLASS];
+/* LOCK_GLOBAL: the one heap lock. LOCK_FINE: serializes mem_sbrk */
+static lock_t heap_lock;
+
+/* Incremental heap checker:
+ * Each mm_checkheap call examines up to check_budget blocks of the heap and
+ * as many entries of the free lists, picking up where the last call stopped,
+ * so that every block is eventually covered (option "check", 0 for none).
+ * A merge that swallows the heap cursor moves it back to the merged block,
+ * and unlinking the list cursor moves it on to the next entry.
+ */
+static size_t check_budget = CHECK_BUDGET;
+static block_t *check_heap_at;   // next block of the heap walk, NULL for heap_start
+static int check_arena;          // arena and list of the list walk
+static int check_list;
+static block_t *check_list_at;   // next entry of the list walk, NULL for its head
+static bool check_list_mid;      // the list walk stopped inside check_list
+#if LOCKING == LOCK_FINE
+/* One thread walks at a time */
+static lock_t check_lock;
+#endif
+
+/* Event counters reported by mm_get_stats, zeroed by mm_init */
+static mm_stats_t stats;
+_Static_assert(MM_STATS_CLASSES == LISTSIZE + 1, "mm_stats_t has a count per class and the mini list");
+
+/* Arena of the calling thread, valid while thread_gen == heap_gen */
+static __thread arena_t *thread_arena;
+static __thread unsigned long thread_gen;
+
+/* Per-thread cache of recently freed blocks:
+ * Cached blocks stay marked allocated in the heap, so neighbours never
+ * coalesce with them. Each bin is a singly-linked LIFO list threaded
+ * through the first payload word, binned by getList() class + 1
+ * (bin 0 holds 16-byte mini blocks).
+ */
+typedef struct tcache
+{
+    unsigned long gen;
+    block_t *bin[TCACHE_BINS];
+    unsigned int count[TCACHE_BINS];
+} tcache_t;
+
+static __thread tcache_t tcache;
 
 bool mm_checkheap(int lineno);
 
 /* Function prototypes for internal helper routines */
-static block_t *extend_heap(size_t size);
-static void place(block_t *block, size_t asize);
-static block_t *find_fit(size_t asize);
-static block_t *coalesce(block_t *block);
+static block_t *extend_heap(arena_t *arena, size_t size);
+static size_t grow_size(arena_t *arena, size_t size);
+static void grow_note_free(arena_t *arena, size_t size);
+static char *place(arena_t *arena, block_t *block, size_t asize);
+static char *fresh_raise(arena_t *arena, char *to);
+static void *malloc_fresh(size_t size, char **zero);
+static block_t *find_fit(arena_t *arena, size_t asize);
+static block_t *coalesce(arena_t *arena, block_t *block);
 
 static size_t max(size_t x, size_t y);
 static size_t round_up(size_t size, size_t n);
 static word_t pack(size_t size, bool alloc);
 
 static size_t extract_size(word_t header);
+static size_t footer_size(word_t word);
 static size_t get_size(block_t *block);
 static size_t get_payload_size(block_t *block);
 
@@ -149,6 +500,11 @@ static bool get_alloc(block_t *block);
 static void write_header(block_t *block, size_t size, bool alloc);
 static void write_footer(block_t *block, size_t size, bool alloc);
 
+static word_t header_load(block_t *block);
+static void header_set(block_t *block, word_t bits);
+static void header_clear(block_t *block, word_t bits);
+static bool is_listed(word_t header);
+
 static block_t *payload_to_header(void *bp);
 static void *header_to_payload(block_t *block);
 
@@ -158,22 +514,519 @@ static block_t *find_prev(block_t *block);
 
 //Extra functions defined by Zhihan
 static int getList(size_t size);
-static void listInsert(block_t *block, size_t size);
-static void listDelete(block_t *block);
-static void printSList();
+static int list_class(size_t size);
+static void tlsf_mapping(size_t size, int *fl, int *sl);
+static void tlsf_insert(arena_t *arena, block_t *block, size_t size);
+static void tlsf_delete(arena_t *arena, block_t *block, size_t size);
+static block_t *tlsf_search(arena_t *arena, size_t size);
+static block_t *tlsf_find_fit(arena_t *arena, size_t asize);
+static void listInsert(arena_t *arena, block_t *block, size_t size);
+static bool treap_before(block_t *a, block_t *b);
+static uint32_t treap_priority(block_t *block);
+static void treap_insert(block_t **root, block_t *block);
+static void treap_delete(block_t **root, block_t *block);
+static block_t *treap_fit(block_t *root, size_t asize);
+static void listDelete(arena_t *arena, block_t *block);
+static void printSList(arena_t *arena);
+static block_t *link_block(uint32_t offset);
+static uint32_t link_offset(block_t *block);
+static block_t *link_next(block_t *block);
+static void link_push(block_t **head, block_t *block);
+static void link_unlink(block_t **head, block_t *block);
+static void link_insert(block_t **head, block_t *after, block_t *block);
+static void class_push(arena_t *arena, int sIndex, block_t *block, size_t size);
+static void class_unlink(arena_t *arena, int sIndex, block_t *block, size_t size);
+static block_t *addr_pred(uint32_t root, block_t *block);
+static int pack_find(arena_t *arena, int sIndex, block_t *block);
+static void pack_set(arena_t *arena, int sIndex, int k, block_t *block, uint32_t rank);
+static uint32_t pack_rank(arena_t *arena, int sIndex, block_t *block, bool front);
+static void pack_renumber(arena_t *arena, int sIndex);
+static void pack_insert(arena_t *arena, int sIndex, block_t *block, block_t *after);
+static void pack_delete(arena_t *arena, int sIndex, block_t *block);
+static block_t *pack_fit(arena_t *arena, int sIndex, size_t asize);
+static block_t *pack_rest(arena_t *arena, int sIndex);
+static void addr_insert(uint32_t *root, block_t *block);
+static void addr_delete(uint32_t *root, block_t *block);
+static exact_t *exact_slot(arena_t *arena, int sIndex, size_t size);
+static void exact_insert(arena_t *arena, int sIndex, block_t *block, size_t size);
+static void exact_delete(arena_t *arena, int sIndex, block_t *block, size_t size);
+static block_t *exact_find(arena_t *arena, int sIndex, size_t size);
 static bool checkAlloc(block_t *block);
+static void free_block(block_t *block);
+static size_t adjust_size(size_t size);
+static bool resize_block(arena_t *arena, block_t *block, size_t asize);
+static bool absorb_next(arena_t *arena, block_t *block, bool listed);
+static void shrink_block(block_t *block, size_t asize);
+static void move_payload(void *dst, void *src, size_t size);
+static size_t carve_run(arena_t *arena, block_t *block, size_t asize, size_t n, void **out);
+static void free_run(arena_t *arena, block_t *first, block_t *last);
+static void release_headerless(void *bp);
+static void free_regular(block_t *block);
+
+static bool is_mapped(void *bp);
+static void *map_malloc(size_t size);
+static void *map_realloc(void *bp, size_t size);
+static void map_free(void *bp);
+static size_t map_slot(void *bp);
+static void map_remove(size_t i);
+static void memlib_lock(void);
+static void memlib_unlock(void);
+static block_t *merge(arena_t *arena, block_t *block);
+static void list_put(arena_t *arena, block_t *block);
+static bool top_join(arena_t *arena, block_t *block);
+static block_t *top_take(arena_t *arena, size_t asize, size_t align);
+static block_t *top_cut(arena_t *arena, size_t size);
+static bool top_absorb(arena_t *arena, block_t *block, size_t asize);
+static block_t *take_exact(arena_t *arena, size_t asize);
+
+static inline void lock_acquire(lock_t *lock);
+static inline bool lock_try(lock_t *lock);
+static void lock_wait(lock_t *lock);
+static inline void lock_release(lock_t *lock);
+static void global_lock(void);
+static void global_unlock(void);
+static void class_lock(arena_t *arena, int sIndex);
+static void class_unlock(arena_t *arena, int sIndex);
+static void class_lock_pair(arena_t *arena, int a, int b);
+static void class_unlock_pair(arena_t *arena, int a, int b);
+static void grow_lock(arena_t *arena);
+static void grow_unlock(arena_t *arena);
+
+static arena_t *arena_get(void);
+static arena_t *arena_of(block_t *block);
+static void arena_map(arena_t *arena, void *lo, void *hi);
+
+static int tcache_bin(size_t size);
+static void tcache_sync(void);
+static block_t *tcache_get(size_t asize);
+static bool tcache_put(int bin, block_t *block);
+static void tcache_refill(arena_t *arena, size_t asize);
+static void tcache_flush(int bin, unsigned int keep);
+static bool tcache_drain(void);
+
+static unsigned long remote_push(arena_t *arena, block_t *block);
+static block_t *remote_pop(arena_t *arena);
+static void remote_drain(arena_t *arena);
+static void release_block(block_t *block);
+
+static block_t *carve_aligned(arena_t *arena, size_t align, size_t size, bool extend);
+static block_t *take_aligned(arena_t *arena, size_t align, size_t asize);
+static size_t aligned_lead(block_t *block, size_t align);
+static bool is_slab(void *bp);
+static slab_t *slab_of(void *bp);
+static void *slab_malloc(arena_t *arena, int cls);
+static bool slab_ready(arena_t *arena, int cls);
+static void slab_free(slab_t *run, void *bp);
+static slab_t *slab_new(arena_t *arena, int cls);
+static void slab_unlink(arena_t *arena, slab_t *run);
+static void slab_release(slab_t *run);
+static bool slab_trim(arena_t *arena);
+static void slab_lock(arena_t *arena, int cls);
+static void slab_unlock(arena_t *arena, int cls);
+static size_t usable_size(void *bp);
+static void free_headerless(void *bp);
+
+static bool is_buddy(void *bp);
+static void *buddy_malloc(arena_t *arena, size_t size);
+static void buddy_free(arena_t *arena, void *bp);
+static void buddy_push(arena_t *arena, block_t *block, int order);
+static void buddy_unlink(arena_t *arena, block_t *block, int order);
+static bool buddy_trim(arena_t *arena);
+static void buddy_lock(arena_t *arena);
+static void buddy_unlock(arena_t *arena);
+static void fast_lock(arena_t *arena);
+static void fast_unlock(arena_t *arena);
+static void fast_push(arena_t *arena, block_t *block);
+static block_t *fast_pop(arena_t *arena, size_t asize);
+static bool fast_consolidate(arena_t *arena);
+static bool check_fail(int line, block_t *block, const char *what);
+static bool check_heap_block(int line, block_t *block);
+static bool check_links(int line, block_t *block, block_t *head);
+static bool check_exact(int line, arena_t *arena, int sIndex, block_t *block, size_t size);
+static bool check_order(int line, arena_t *arena, int sIndex, block_t *block);
+static bool check_pack(int line, arena_t *arena, int sIndex, block_t *block);
+static bool check_heap_slice(int line);
+static bool check_list_entry(int line, arena_t *arena, int list, block_t *block, block_t *head);
+static block_t **check_list_head(arena_t *arena, int list, int *sIndex);
+static bool check_list_slice(int line);
+static void check_merged(block_t *block);
+static block_t *next_segment(block_t *end);
+static void stat_add(unsigned long *counter, unsigned long n);
+static block_t *seglist_find_fit(arena_t *arena, size_t asize, unsigned long *visited);
+static void stats_list(mm_stats_t *out, block_t *block);
+static void stats_treap(mm_stats_t *out, block_t *node);
+static void stats_block(mm_stats_t *out, block_t *block);
 
 /* printSList: Prints the SMALL BLOCKS LIST, used only in debugging and mm_checkheap()
  */
-static void printSList() //print small list
+static void printSList(arena_t *arena) //print small list
 {
-    block_t * ptr = smallListHeader;
+    block_t * ptr = arena -> smallListHeader;
    
     while (ptr != NULL)
     {
-   
-        ptr = ptr -> payload.links.next;
+        dbg_printf("%p ", (void *)ptr);
+        ptr = link_next(ptr);
+    }
+    dbg_printf("\n");
+}
+
+/* link_block: Converts an offset stored in a list link back to its block, NULL for 0.
+ */
+static block_t *link_block(uint32_t offset)
+{
+    if (offset == 0)
+        return NULL;
+    return (block_t *)(heap_lo + offset);
+}
+
+/* link_offset: Returns the offset of a block from the heap start, 0 for NULL.
+ * The prologue sits at offset 0, so no free block ever has that offset.
+ */
+static uint32_t link_offset(block_t *block)
+{
+    if (block == NULL)
+        return 0;
+    dbg_requires((size_t)((char *)block - heap_lo) <= UINT32_MAX);
+    return (char *)block - heap_lo;
+}
+
+/* link_next: Returns the block after this one in its free list, or NULL.
+ */
+static block_t *link_next(block_t *block)
+{
+    return link_block(block -> payload.link.next);
+}
+
+/* link_push: Pushes a block onto the front of the doubly linked list at head.
+ */
+static void link_push(block_t **head, block_t *block)
+{
+    block -> payload.link.prev = 0;
+    block -> payload.link.next = link_offset(*head);
+    if (*head != NULL)
+        (*head) -> payload.link.prev = link_offset(block);
+    *head = block;
+}
+
+/* link_unlink: Unlinks a block from the doubly linked list at head, through
+ * its offsets, without walking the list.
+ */
+static void link_unlink(block_t **head, block_t *block)
+{
+    block_t *blockNext = link_block(block -> payload.link.next);
+    block_t *blockPrev = link_block(block -> payload.link.prev);
+
+    // The checker's list cursor moves on rather than dangle
+    if (__atomic_load_n(&check_list_at, __ATOMIC_RELAXED) == block)
+        __atomic_store_n(&check_list_at, blockNext, __ATOMIC_RELAXED);
+    if (blockPrev != NULL)
+        blockPrev -> payload.link.next = block -> payload.link.next;
+    else
+        *head = blockNext;
+    if (blockNext != NULL)
+        blockNext -> payload.link.prev = block -> payload.link.prev;
+}
+
+/* link_insert: Links a block into the doubly linked list at head right after the
+ * block after, or at the front if after is NULL.
+ */
+static void link_insert(block_t **head, block_t *after, block_t *block)
+{
+    block_t *next;
+
+    if (after == NULL)
+    {
+        link_push(head, block);
+        return;
+    }
+    next = link_next(after);
+    block -> payload.link.prev = link_offset(after);
+    block -> payload.link.next = after -> payload.link.next;
+    if (next != NULL)
+        next -> payload.link.prev = link_offset(block);
+    after -> payload.link.next = link_offset(block);
+}
+
+/* class_push: Links a free block into the list of class sIndex, below TREE_CLASS, where the
+ * class's order puts it: at the head and into the exact-size index (ORDER_LIFO), at the
+ * tail (ORDER_FIFO), or right after the listed block below it (ORDER_ADDR).
+ */
+static void class_push(arena_t *arena, int sIndex, block_t *block, size_t size)
+{
+    block_t **head = &arena -> listHeader[sIndex], *after = NULL;
+
+    if (order[sIndex] == ORDER_FIFO)
+    {
+        after = arena -> listTail[sIndex];
+        link_insert(head, after, block);
+        arena -> listTail[sIndex] = block;
+    }
+    else if (order[sIndex] == ORDER_ADDR)
+    {
+        after = addr_pred(arena -> addrRoot[sIndex], block);
+        link_insert(head, after, block);
+        addr_insert(&arena -> addrRoot[sIndex], block);
+    }
+    else
+    {
+        link_push(head, block);
+        exact_insert(arena, sIndex, block, size);
+    }
+    pack_insert(arena, sIndex, block, after);
+}
+
+/* class_unlink: Unlinks a free block from the list of class sIndex, below TREE_CLASS, and
+ * from the structure its order keeps beside the list.
+ */
+static void class_unlink(arena_t *arena, int sIndex, block_t *block, size_t size)
+{
+    if (order[sIndex] == ORDER_FIFO && arena -> listTail[sIndex] == block)
+        arena -> listTail[sIndex] = link_block(block -> payload.link.prev);
+    link_unlink(&arena -> listHeader[sIndex], block);
+    pack_delete(arena, sIndex, block);
+    if (order[sIndex] == ORDER_ADDR)
+        addr_delete(&arena -> addrRoot[sIndex], block);
+    else if (order[sIndex] == ORDER_LIFO)
+        exact_delete(arena, sIndex, block, size);
+}
+
+/* pack_find: Returns the index of a block among the packed entries of class sIndex,
+ * comparing PACK_VEC offsets at a time, or -1 if it is loose.
+ */
+static int pack_find(arena_t *arena, int sIndex, block_t *block)
+{
+    pack_vec_t want = (pack_vec_t){0} + (int32_t)link_offset(block), hit;
+    uint64_t words[sizeof(pack_vec_t) / sizeof(uint64_t)], any;
+    int v, lane, w;
+
+    for (v = 0; v * PACK_VEC < arena -> pack_count[sIndex]; v++)
+    {
+        hit = arena -> pack_off[sIndex][v] == want;
+        memcpy(words, &hit, sizeof(words));
+        for (any = 0, w = 0; w < (int)(sizeof(words) / sizeof(words[0])); w++)
+            any |= words[w];
+        if (any == 0)
+            continue;
+        for (lane = 0; hit[lane] == 0; lane++)
+            ;
+        return v * PACK_VEC + lane;
+    }
+    return -1;
+}
+
+/* pack_set: Stores the size, offset and list rank of a block, or zeros for NULL, in
+ * packed entry k of class sIndex.
+ */
+static void pack_set(arena_t *arena, int sIndex, int k, block_t *block, uint32_t rank)
+{
+    arena -> pack_size[sIndex][k / PACK_VEC][k % PACK_VEC] = (block != NULL) ? (int32_t)get_size(block) : 0;
+    arena -> pack_off[sIndex][k / PACK_VEC][k % PACK_VEC] = link_offset(block);
+    arena -> pack_rank[sIndex][k / PACK_VEC][k % PACK_VEC] = rank;
+}
+
+/* pack_rank: Returns the list rank of a block about to be packed at the front of the
+ * packed entries of class sIndex, or at their end. An ORDER_ADDR list is ranked by
+ * address; other lists only grow at either end, so a counter per end ranks them.
+ */
+static uint32_t pack_rank(arena_t *arena, int sIndex, block_t *block, bool front)
+{
+    if (order[sIndex] == ORDER_ADDR)
+        return link_offset(block);
+    if (arena -> pack_front[sIndex] == 0 || arena -> pack_back[sIndex] == UINT32_MAX)
+        pack_renumber(arena, sIndex);
+    return front ? --arena -> pack_front[sIndex] : ++arena -> pack_back[sIndex];
+}
+
+/* pack_renumber: Ranks the packed entries of class sIndex again from PACK_MID on, in
+ * list order, once a counter runs out. The packed blocks are the first in the list,
+ * bar one just linked and not packed yet or one just unlinked and not dropped yet.
+ */
+static void pack_renumber(arena_t *arena, int sIndex)
+{
+    block_t *block;
+    uint32_t rank = PACK_MID;
+    int k;
+
+    for (block = arena -> listHeader[sIndex];
+         block != NULL && rank - PACK_MID < (uint32_t)arena -> pack_count[sIndex]; block = link_next(block))
+    {
+        k = pack_find(arena, sIndex, block);
+        if (k >= 0)
+            arena -> pack_rank[sIndex][k / PACK_VEC][k % PACK_VEC] = rank++;
+    }
+    arena -> pack_front[sIndex] = PACK_MID;
+    arena -> pack_back[sIndex] = rank - 1;
+}
+
+/* pack_insert: Packs a block just linked into list sIndex after the block after (NULL
+ * for the head) if that puts it among the first PACK_SLOTS, loosening the last packed
+ * block if the entries are full. Otherwise the block is loose.
+ */
+static void pack_insert(arena_t *arena, int sIndex, block_t *block, block_t *after)
+{
+    block_t *last = arena -> pack_last[sIndex];
+    int n = arena -> pack_count[sIndex];
+
+    if (n < PACK_SLOTS)
+    {
+        // Nothing is loose, so the whole list is packed
+        pack_set(arena, sIndex, n, block, pack_rank(arena, sIndex, block, after == NULL));
+        arena -> pack_count[sIndex] = n + 1;
+        if (after == last)
+            arena -> pack_last[sIndex] = block;
+        return;
+    }
+    arena -> pack_loose[sIndex]++;
+    if (after == last || (after != NULL && pack_find(arena, sIndex, after) < 0))
+        return;
+    pack_set(arena, sIndex, pack_find(arena, sIndex, last), block, pack_rank(arena, sIndex, block, after == NULL));
+    arena -> pack_last[sIndex] = link_block(last -> payload.link.prev);
+}
+
+/* pack_delete: Drops a block just unlinked from list sIndex from the packed entries,
+ * moving the last entry into its place, and packs the first loose block, if any, in
+ * its stead. A loose block only needs counting.
+ */
+static void pack_delete(arena_t *arena, int sIndex, block_t *block)
+{
+    int k = pack_find(arena, sIndex, block), n = arena -> pack_count[sIndex] - 1;
+    block_t *next;
+
+    if (k < 0)
+    {
+        arena -> pack_loose[sIndex]--;
+        return;
+    }
+    if (arena -> pack_last[sIndex] == block)
+        arena -> pack_last[sIndex] = link_block(block -> payload.link.prev);
+    if (arena -> pack_loose[sIndex] != 0)
+    {
+        next = pack_rest(arena, sIndex);
+        pack_set(arena, sIndex, k, next, pack_rank(arena, sIndex, next, false));
+        arena -> pack_last[sIndex] = next;
+        arena -> pack_loose[sIndex]--;
+        return;
+    }
+    arena -> pack_size[sIndex][k / PACK_VEC][k % PACK_VEC] = arena -> pack_size[sIndex][n / PACK_VEC][n % PACK_VEC];
+    arena -> pack_off[sIndex][k / PACK_VEC][k % PACK_VEC] = arena -> pack_off[sIndex][n / PACK_VEC][n % PACK_VEC];
+    arena -> pack_rank[sIndex][k / PACK_VEC][k % PACK_VEC] = arena -> pack_rank[sIndex][n / PACK_VEC][n % PACK_VEC];
+    pack_set(arena, sIndex, n, NULL, 0);
+    arena -> pack_count[sIndex] = n;
+}
+
+/* pack_fit: Returns the smallest packed block of class sIndex with at least asize bytes,
+ * the first in list order among equals, as a walk of the list would, or NULL. Each step
+ * compares PACK_VEC sizes at once and keeps the smallest fit seen in each lane, and of
+ * equal fits the one of lowest rank; no block is visited.
+ */
+static block_t *pack_fit(arena_t *arena, int sIndex, size_t asize)
+{
+    pack_vec_t want = (pack_vec_t){0} + (int32_t)asize;
+    pack_vec_t none = (pack_vec_t){0} + INT32_MAX;
+    pack_vec_t best = none, at = {0}, size, fits, less;
+    pack_vec_t index;
+    pack_rank_t first = (pack_rank_t){0} + UINT32_MAX, rank;
+    int v, lane, k = -1;
+    int32_t min = INT32_MAX;
+    uint32_t low = UINT32_MAX;
+
+    for (lane = 0; lane < PACK_VEC; lane++)
+        index[lane] = lane;
+    for (v = 0; v * PACK_VEC < arena -> pack_count[sIndex]; v++)
+    {
+        size = arena -> pack_size[sIndex][v];
+        rank = arena -> pack_rank[sIndex][v];
+        fits = size >= want;
+        size = (size & fits) | (none & ~fits);
+        less = (size < best) | ((size == best) & (rank < first));
+        best = (size & less) | (best & ~less);
+        first = (rank & (pack_rank_t)less) | (first & ~(pack_rank_t)less);
+        at = (index & less) | (at & ~less);
+        index += PACK_VEC;
+    }
+    for (lane = 0; lane < PACK_VEC; lane++)
+    {
+        if (best[lane] < min || (best[lane] == min && min != INT32_MAX && first[lane] < low))
+        {
+            min = best[lane];
+            low = first[lane];
+            k = at[lane];
+        }
+    }
+    if (min == INT32_MAX)
+        return NULL;
+    return link_block(arena -> pack_off[sIndex][k / PACK_VEC][k % PACK_VEC]);
+}
+
+/* pack_rest: Returns the first loose block of class sIndex, or NULL if there is none.
+ */
+static block_t *pack_rest(arena_t *arena, int sIndex)
+{
+    if (arena -> pack_loose[sIndex] == 0)
+        return NULL;
+    if (arena -> pack_last[sIndex] == NULL)
+        return arena -> listHeader[sIndex];
+    return link_next(arena -> pack_last[sIndex]);
+}
+
+/* exact_slot: Returns the slot of a class's exact-size index that blocks of this size hash to.
+ */
+static exact_t *exact_slot(arena_t *arena, int sIndex, size_t size)
+{
+    return &arena -> exact[sIndex][(size >> 4) % EXACT_SLOTS];
+}
+
+/* exact_insert: Pushes a free block of class sIndex onto the chain of its size, claiming
+ * the slot if it is free. If the slot holds blocks of another size, the block is left
+ * out of the index; the class walk still finds it.
+ */
+static void exact_insert(arena_t *arena, int sIndex, block_t *block, size_t size)
+{
+    exact_t *slot = exact_slot(arena, sIndex, size);
+    block_t *head = link_block(slot -> head);
+
+    if (head != NULL && slot -> size != size)
+    {
+        block -> payload.link.same_prev = EXACT_NONE;
+        return;
     }
+    slot -> size = size;
+    block -> payload.link.same_prev = 0;
+    block -> payload.link.same_next = slot -> head;
+    if (head != NULL)
+        head -> payload.link.same_prev = link_offset(block);
+    slot -> head = link_offset(block);
+}
+
+/* exact_delete: Unlinks a free block of class sIndex from the chain of its size, if it
+ * is on one. A slot whose chain empties is free for any size.
+ */
+static void exact_delete(arena_t *arena, int sIndex, block_t *block, size_t size)
+{
+    uint32_t next = block -> payload.link.same_next;
+    uint32_t prev = block -> payload.link.same_prev;
+
+    if (prev == EXACT_NONE)
+        return;
+    if (prev != 0)
+        link_block(prev) -> payload.link.same_next = next;
+    else
+        exact_slot(arena, sIndex, size) -> head = next;
+    if (next != 0)
+        link_block(next) -> payload.link.same_prev = prev;
+}
+
+/* exact_find: Returns a free block of exactly size bytes from the exact-size index of
+ * class sIndex, still on its lists, or NULL if the index holds none.
+ */
+static block_t *exact_find(arena_t *arena, int sIndex, size_t size)
+{
+    exact_t *slot = exact_slot(arena, sIndex, size);
+
+    if (slot -> size != size)
+        return NULL;
+    return link_block(slot -> head);
 }
 
 /* getList: For a particular size argument, it returns the class which belongs to in the segregated list.
@@ -212,134 +1065,439 @@ static int getList(size_t size)
 
 }
 
+/* list_class: Returns the class whose lock guards free blocks of this size: -1 for
+ * mini blocks, the getList() class for ENGINE_SEGLIST, and 0 for every TLSF list.
+ */
+static int list_class(size_t size)
+{
+    if (engine == ENGINE_TLSF && size > dsize)
+        return 0;
+    return getList(size);
+}
+
+/* tlsf_mapping: For a block size, returns the first level (floor of log2) and the
+ * second level (which of the TLSF_SL equal parts of that power of two) of its list.
+ */
+static void tlsf_mapping(size_t size, int *fl, int *sl)
+{
+    *fl = 63 - __builtin_clzl(size);
+    *sl = (size >> (*fl - TLSF_SL_SHIFT)) ^ TLSF_SL;
+}
+
+/* tlsf_insert: Pushes a free block onto its TLSF list and marks the list non-empty.
+ */
+static void tlsf_insert(arena_t *arena, block_t *block, size_t size)
+{
+    int fl, sl;
+
+    tlsf_mapping(size, &fl, &sl);
+    link_push(&arena -> tlsf[fl][sl], block);
+    arena -> tlsf_sl[fl] |= 1U << sl;
+    arena -> tlsf_fl |= 1U << fl;
+}
+
+/* tlsf_delete: Unlinks a free block from its TLSF list, clearing the bitmap bits
+ * of lists that become empty.
+ */
+static void tlsf_delete(arena_t *arena, block_t *block, size_t size)
+{
+    int fl, sl;
+
+    tlsf_mapping(size, &fl, &sl);
+    link_unlink(&arena -> tlsf[fl][sl], block);
+
+    if (arena -> tlsf[fl][sl] == NULL)
+    {
+        arena -> tlsf_sl[fl] &= ~(1U << sl);
+        if (arena -> tlsf_sl[fl] == 0)
+            arena -> tlsf_fl &= ~(1U << fl);
+    }
+}
+
+/* tlsf_search: Returns the head of the first non-empty TLSF list whose blocks are all
+ * at least size bytes, or NULL. The size is rounded up to the next list boundary, so
+ * the head always fits: two bitmap lookups, no list walk.
+ */
+static block_t *tlsf_search(arena_t *arena, size_t size)
+{
+    int fl, sl;
+    unsigned int map;
+
+    tlsf_mapping(size, &fl, &sl);
+    size += (1UL << (fl - TLSF_SL_SHIFT)) - 1;
+    tlsf_mapping(size, &fl, &sl);
+    if (fl >= TLSF_FL)
+        return NULL;
+
+    map = arena -> tlsf_sl[fl] & (~0U << sl);
+    if (map == 0)
+    {
+        // Nothing left in this power of two: take the next non-empty one
+        map = (fl + 1 < TLSF_FL) ? arena -> tlsf_fl & (~0U << (fl + 1)) : 0;
+        if (map == 0)
+            return NULL;
+        fl = __builtin_ctz(map);
+        map = arena -> tlsf_sl[fl];
+    }
+    sl = __builtin_ctz(map);
+    return arena -> tlsf[fl][sl];
+}
+
 /* listInsert: For a particular block and its size taken as arguments, this function inserts the block into either the seg list or the small blocks list. 
 If the size <= 16 bytes, it inserts the block into the small blocks list. 
 Otherwise, it inserts the block into the seg list.
+The LBIT of the block is set. Under LOCK_FINE the caller holds the class lock.
  */
-static inline void listInsert(block_t *block, size_t size)
+static inline void listInsert(arena_t *arena, block_t *block, size_t size)
 {
+    header_set(block, LBIT);
 
     // Insert into segregated list for big sizes
     // Insert into the beginning of the list
     if (size > dsize)
     {   
-        PREVBLOCK = NULL;
+        if (engine == ENGINE_TLSF)
+        {
+            tlsf_insert(arena, block, size);
+            return;
+        }
         int sIndex = getList(size);
-        NEXTBLOCK = listHeader[sIndex];
-        if(listHeader[sIndex] != NULL)
-            listHeader[sIndex] -> payload.links.prev = block;
-        listHeader[sIndex] = block;
+        if (sIndex == TREE_CLASS)
+        {
+            treap_insert(&arena -> listHeader[TREE_CLASS], block);
+            return;
+        }
+        class_push(arena, sIndex, block, size);
         return;
     }
     // Insert into small blocks list for small blocks
-    // Insert into beginning of the list
+    // Insert into beginning of the list. The links overwrite the footer,
+    // which footer_size can tell as long as blocks are where it expects
     else
     {
-        //printSList();
-        NEXTBLOCK = smallListHeader;
-        smallListHeader = block;
-        //printSList();
-    }    
+        dbg_assert(link_offset(block) % dsize == wsize);
+        link_push(&arena -> smallListHeader, block);
+    }
 }
 
 /* listDelete: For a particular block and its size taken as arguments, this function deletes the block from either the seg list or the small blocks list. 
 If the size <= 16 bytes, it deletes the block from the small blocks list. 
 Otherwise, it deletes the block from the seg list.
+The LBIT of the block is cleared. Under LOCK_FINE the caller holds the class lock.
  */
-static inline void listDelete(block_t *block)
+static inline void listDelete(arena_t *arena, block_t *block)
 { 
     size_t size = get_size(block);
-    int sIndex = 0;
+    int sIndex;
 
-    block_t *blockPrev;
-    block_t *ptr,*prv=NULL;
-    block_t *blockNext;
+    header_clear(block, LBIT);
     // Delete from segregated list for big sizes
     if (size > dsize)
     {
-        blockNext = NEXTBLOCK;
-        blockPrev = PREVBLOCK;
-        if(blockPrev != NULL)
-            blockPrev -> payload.links.next = blockNext;
-        else
+        if (engine == ENGINE_TLSF)
         {
-            sIndex = getList(size);
-            listHeader[sIndex] = blockNext;       
+            tlsf_delete(arena, block, size);
+            return;
         }
-    if (blockNext != NULL)
-        blockNext -> payload.links.prev = blockPrev;
-    return;
+        sIndex = getList(size);
+        if (sIndex == TREE_CLASS)
+        {
+            treap_delete(&arena -> listHeader[TREE_CLASS], block);
+            return;
+        }
+        class_unlink(arena, sIndex, block, size);
     }
 
     // Delete from small blocks list for small sizes
     else
-    {   //printSList();
-        ptr = smallListHeader;
-        while (ptr != NULL)
-        {
-            if (ptr == block)
-            {   
-                if (ptr == smallListHeader)
-                {
-                    smallListHeader = ptr -> payload.links.next;
-                    printSList(); 
-                    return;
-                }
-                prv->payload.links.next = ptr -> payload.links.next;
-                //printSList();
-                return;
-            }
-            prv = ptr;
-            ptr = ptr -> payload.links.next;
-        }
-      
-    }   
+        link_unlink(&arena -> smallListHeader, block);
 }
 
-/*
- * write_header: given a block and its size and allocation status,
- *               writes an appropriate value to the block header. 
- *               It also sets the SBIT and ABIT in the next block 
- *               accordingly.
+/* treap_before: Orders the blocks of the treap by size, then by address.
  */
-static void write_header(block_t *block, size_t size, bool alloc)
+static bool treap_before(block_t *a, block_t *b)
 {
-    block_t *temp;
-    // If small block encountered, set SBIT of next block
-    if((size & size_mask) == dsize)
-    {
-        temp = (block_t *)(((char*)block) + dsize);
-        temp -> header = temp -> header | SBIT;
-    }
-    // Carry over the SBIT and pack
-    block->header = pack(size|(block->header&SBIT), alloc);
-    // If allocated block encountered, set ABIT of next block
-    if(alloc == true)
-    {
+    size_t asize = get_size(a), bsize = get_size(b);
+    return asize < bsize || (asize == bsize && a < b);
+}
+
+/* treap_priority: Returns the heap priority of a treap node, a hash of its
+ * address, so that the tree stays balanced in expectation without storing it.
+ */
+static uint32_t treap_priority(block_t *block)
+{
+    return (uint32_t)(((uintptr_t)block * 0x9E3779B97F4A7C15UL) >> 32);
+}
+
+/* treap_insert: Inserts a block into the treap. It goes where its priority
+ * puts it on the search path, and the subtree found there is split around it.
+ */
+static void treap_insert(block_t **root, block_t *block)
+{
+    block_t **link = root, *node, **left, **right;
+    uint32_t priority = treap_priority(block);
+
+    while (*link != NULL && treap_priority(*link) > priority)
+        link = treap_before(block, *link) ? &(*link) -> payload.tree.left
+                                          : &(*link) -> payload.tree.right;
+    node = *link;
+    *link = block;
+    left = &block -> payload.tree.left;
+    right = &block -> payload.tree.right;
+    while (node != NULL)
+    {
+        if (treap_before(node, block))
+        {
+            *left = node;
+            left = &node -> payload.tree.right;
+            node = node -> payload.tree.right;
+        }
+        else
+        {
+            *right = node;
+            right = &node -> payload.tree.left;
+            node = node -> payload.tree.left;
+        }
+    }
+    *left = NULL;
+    *right = NULL;
+}
+
+/* treap_delete: Removes a block from the treap, merging its two subtrees
+ * in its place by priority.
+ */
+static void treap_delete(block_t **root, block_t *block)
+{
+    block_t **link = root, *a, *b;
+
+    while (*link != block)
+        link = treap_before(block, *link) ? &(*link) -> payload.tree.left
+                                          : &(*link) -> payload.tree.right;
+    a = block -> payload.tree.left;
+    b = block -> payload.tree.right;
+    while (a != NULL && b != NULL)
+    {
+        if (treap_priority(a) > treap_priority(b))
+        {
+            *link = a;
+            link = &a -> payload.tree.right;
+            a = a -> payload.tree.right;
+        }
+        else
+        {
+            *link = b;
+            link = &b -> payload.tree.left;
+            b = b -> payload.tree.left;
+        }
+    }
+    *link = (a != NULL) ? a : b;
+}
+
+/* addr_pred: Returns the block of the address treap at root that comes last below
+ * block, or NULL if there is none.
+ */
+static block_t *addr_pred(uint32_t root, block_t *block)
+{
+    block_t *node = link_block(root), *pred = NULL;
+
+    while (node != NULL)
+    {
+        if (node < block)
+        {
+            pred = node;
+            node = link_block(node -> payload.addr.right);
+        }
+        else
+            node = link_block(node -> payload.addr.left);
+    }
+    return pred;
+}
+
+/* addr_insert: Inserts a block into an address treap, as treap_insert does
+ * with the size treap, its links being heap offsets.
+ */
+static void addr_insert(uint32_t *root, block_t *block)
+{
+    uint32_t *link = root, *left, *right;
+    uint32_t priority = treap_priority(block);
+    block_t *node;
+
+    while (*link != 0 && treap_priority(link_block(*link)) > priority)
+    {
+        node = link_block(*link);
+        link = (block < node) ? &node -> payload.addr.left : &node -> payload.addr.right;
+    }
+    node = link_block(*link);
+    *link = link_offset(block);
+    left = &block -> payload.addr.left;
+    right = &block -> payload.addr.right;
+    while (node != NULL)
+    {
+        if (node < block)
+        {
+            *left = link_offset(node);
+            left = &node -> payload.addr.right;
+            node = link_block(node -> payload.addr.right);
+        }
+        else
+        {
+            *right = link_offset(node);
+            right = &node -> payload.addr.left;
+            node = link_block(node -> payload.addr.left);
+        }
+    }
+    *left = 0;
+    *right = 0;
+}
+
+/* addr_delete: Removes a block from an address treap, merging its two
+ * subtrees in its place by priority.
+ */
+static void addr_delete(uint32_t *root, block_t *block)
+{
+    uint32_t *link = root;
+    block_t *node, *a, *b;
+
+    while ((node = link_block(*link)) != block)
+        link = (block < node) ? &node -> payload.addr.left : &node -> payload.addr.right;
+    a = link_block(block -> payload.addr.left);
+    b = link_block(block -> payload.addr.right);
+    while (a != NULL && b != NULL)
+    {
+        if (treap_priority(a) > treap_priority(b))
+        {
+            *link = link_offset(a);
+            link = &a -> payload.addr.right;
+            a = link_block(a -> payload.addr.right);
+        }
+        else
+        {
+            *link = link_offset(b);
+            link = &b -> payload.addr.left;
+            b = link_block(b -> payload.addr.left);
+        }
+    }
+    *link = link_offset((a != NULL) ? a : b);
+}
+
+/* treap_fit: Returns the smallest block of the treap with at least asize
+ * bytes, the lowest-addressed one among equals, or NULL if there is none.
+ */
+static block_t *treap_fit(block_t *root, size_t asize)
+{
+    block_t *best = NULL;
+
+    while (root != NULL)
+    {
+        if (get_size(root) >= asize)
+        {
+            best = root;
+            root = root -> payload.tree.left;
+        }
+        else
+            root = root -> payload.tree.right;
+    }
+    return best;
+}
+
+/*
+ * write_header: given a block and its size and allocation status,
+ *               writes an appropriate value to the block header. 
+ *               It also sets the ABIT in the next block 
+ *               accordingly.
+ */
+static void write_header(block_t *block, size_t size, bool alloc)
+{
+    block_t *temp;
+    word_t header, value;
+    // Pack, carrying over the ABIT, which belongs to the previous
+    // block's owner and may change under us with LOCK_FINE
+    value = pack(size & ~(word_t)(LBIT | alloc_mask), alloc);
+#if LOCKING == LOCK_FINE
+    header = __atomic_load_n(&block->header, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&block->header, &header,
+                value | (header & ABIT), true,
+                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        ;
+#else
+    header = block->header;
+    block->header = value | (header & ABIT);
+#endif
+    // If allocated block encountered, set ABIT of next block
+    if(alloc == true)
+    {
         temp = find_next(block);   
         // If prologue or end, return without doing anything
         if(temp == block)
             return;
-        temp -> header = temp -> header | ABIT;
+        header_set(temp, ABIT);
     }
 }
 
 /*
  * write_footer: given a block and its size and allocation status,
  *               writes an appropriate value to the block footer by first
- *               computing the position of the footer.
+ *               computing the position of the footer. A mini block's
+ *               footer is its payload word, so it is written before the
+ *               block is linked into a list.
  */
 static void write_footer(block_t *block, size_t size, bool alloc)
 {
    
     word_t *footerp;
-    // If small block encountered, return without doing anything
-    if(size <= dsize)
-        return;
+    dbg_requires(size <= UINT32_MAX);
     footerp = (word_t *)((block -> payload.data) + get_size(block) - dsize);
     *footerp = pack(size, alloc);
 }
 
+/*
+ * header_load: reads a header that another thread may be updating.
+ */
+static word_t header_load(block_t *block)
+{
+#if LOCKING == LOCK_FINE
+    return __atomic_load_n(&block->header, __ATOMIC_ACQUIRE);
+#else
+    return block->header;
+#endif
+}
+
+/*
+ * header_set: sets flag bits in a header.
+ */
+static void header_set(block_t *block, word_t bits)
+{
+#if LOCKING == LOCK_FINE
+    // Most calls find the bits already set; skip the locked instruction
+    if ((__atomic_load_n(&block->header, __ATOMIC_RELAXED) & bits) != bits)
+        __atomic_fetch_or(&block->header, bits, __ATOMIC_ACQ_REL);
+#else
+    block->header |= bits;
+#endif
+}
+
+/*
+ * header_clear: clears flag bits in a header.
+ */
+static void header_clear(block_t *block, word_t bits)
+{
+#if LOCKING == LOCK_FINE
+    if (__atomic_load_n(&block->header, __ATOMIC_RELAXED) & bits)
+        __atomic_fetch_and(&block->header, ~bits, __ATOMIC_ACQ_REL);
+#else
+    block->header &= ~bits;
+#endif
+}
+
+/*
+ * is_listed: returns true if the header belongs to a free block that sits
+ *            on a free list, i.e. one that coalesce may take over.
+ */
+static bool is_listed(word_t header)
+{
+    return !extract_alloc(header) && (header & LBIT);
+}
+
 /*
  * <what does mm_init do?>
  * Initializes the heap; it is run once when heap_start == NULL.
@@ -353,7 +1511,7 @@ bool mm_init(void)
     // Create the initial empty heap 
     word_t *start = (word_t *)(mem_sbrk(2*wsize));
 
-    int i;
+    int i, j;
 
     if (start == (void *)-1) 
     {
@@ -365,34 +1523,92 @@ bool mm_init(void)
     
     // Heap starts with first "block header", currently the end footer
     heap_start = (block_t *) & (start[1]);
+    heap_lo = (char *)mem_heap_lo();
+    heap_gen++;
+    engine = engine_next;
+    memcpy(order, order_next, sizeof(order));
 
-    for(i=0; i < LISTSIZE; i++)
-        listHeader[i] = NULL;  
-        smallListHeader = NULL;
+    // Every arena starts empty; arena 0 owns the initial segment
+    for (i = 0; i < ARENAS; i++)
+    {
+        for (j = 0; j < LISTSIZE; j++)
+            arenas[i].listHeader[j] = NULL;
+        arenas[i].smallListHeader = NULL;
+        memset(arenas[i].exact, 0, sizeof(arenas[i].exact));
+        memset(arenas[i].listTail, 0, sizeof(arenas[i].listTail));
+        memset(arenas[i].addrRoot, 0, sizeof(arenas[i].addrRoot));
+        memset(arenas[i].pack_size, 0, sizeof(arenas[i].pack_size));
+        memset(arenas[i].pack_off, 0, sizeof(arenas[i].pack_off));
+        memset(arenas[i].pack_count, 0, sizeof(arenas[i].pack_count));
+        memset(arenas[i].pack_last, 0, sizeof(arenas[i].pack_last));
+        memset(arenas[i].pack_loose, 0, sizeof(arenas[i].pack_loose));
+        memset(arenas[i].pack_rank, 0, sizeof(arenas[i].pack_rank));
+        for (j = 0; j < TREE_CLASS; j++)
+        {
+            arenas[i].pack_front[j] = PACK_MID;
+            arenas[i].pack_back[j] = PACK_MID - 1;
+        }
+        arenas[i].epilogue = NULL;
+        arenas[i].top = NULL;
+        arenas[i].fresh = NULL;
+        arenas[i].id = i;
+        memset(arenas[i].locks, 0, sizeof(arenas[i].locks));
+        arenas[i].remote_stub.payload.links.next = NULL;
+        arenas[i].remote_head = &arenas[i].remote_stub;
+        arenas[i].remote_tail = &arenas[i].remote_stub;
+        arenas[i].remote_count = 0;
+        memset(&arenas[i].remote_lock, 0, sizeof(lock_t));
+        memset(arenas[i].slabs, 0, sizeof(arenas[i].slabs));
+        memset(arenas[i].slab_warm, 0, sizeof(arenas[i].slab_warm));
+        memset(arenas[i].buddy, 0, sizeof(arenas[i].buddy));
+        arenas[i].buddy_map = 0;
+        arenas[i].buddy_full = false;
+        memset(arenas[i].fast, 0, sizeof(arenas[i].fast));
+        arenas[i].fast_count = 0;
+        arenas[i].grow_step = chunksize;
+        arenas[i].grow_freed = 0;
+        arenas[i].grow_hot = false;
+        arenas[i].tlsf_fl = 0;
+        memset(arenas[i].tlsf_sl, 0, sizeof(arenas[i].tlsf_sl));
+        memset(arenas[i].tlsf, 0, sizeof(arenas[i].tlsf));
+    }
+    memset(&heap_lock, 0, sizeof(heap_lock));
+    memset(mappings, 0, sizeof(mappings));
+    mapping_count = 0;
+    arena_next = 0;
+    check_heap_at = NULL;
+    check_arena = 0;
+    check_list = 0;
+    check_list_at = NULL;
+    check_list_mid = false;
+    memset(&stats, 0, sizeof(stats));
+    arenas[0].epilogue = heap_start;
+    arena_map(&arenas[0], start, &start[2]);
     
     // Extend the empty heap with a free block of chunksize bytes
-    if (extend_heap(chunksize) == NULL)
+    block_t *block = extend_heap(&arenas[0], chunksize);
+    if (block == NULL)
     {
         return false;
     }
+    list_put(&arenas[0], block);
     return true;
 }
 
 /*
- * <what does mmalloc do?>
- * Allocates a block with size at least (size + dsize), rounded up to the nearest 16 bytes, with a minimum of 2*dsize. 
- * Seeks a sufficiently-large unallocated block on the heap to be allocated.
- * If no such block is found, extends heap by the maximum between chunksize and (size + dsize) rounded up to the nearest 16 bytes, and then attempts to allocate all, or a part of, that memory.
- * Returns NULL on failure, otherwise returns a pointer to such block.
- * The allocated block will not be used for further allocations until freed.
+ * malloc_fresh: allocates like malloc, and stores in *zero the first
+ * payload byte from which the block is known to read as zero, apart from
+ * its last word, or NULL if no byte is.
  */
-void *malloc(size_t size) 
+static void *malloc_fresh(size_t size, char **zero)
 {
     size_t asize;      // Adjusted block size
     size_t extendsize; // Amount to extend heap if no fit is found
     block_t *block;
+    arena_t *arena;
     void *bp = NULL;
 
+    *zero = NULL;
     if (heap_start == NULL) // Initialize heap if it isn't initialized
     {
         mm_init();
@@ -404,194 +1620,2420 @@ void *malloc(size_t size)
         return bp;
     }
 
-   // Smallest Block Size = 16 bytes
-   if(size <= 8)
-   {
-        asize = min_block_size/2;
-   }
+    // Huge requests get a mapping of their own, if one can be had
+    if (mmap_min != 0 && size >= mmap_min)
+    {
+        bp = map_malloc(size);
+        if (bp != NULL)
+        {
+            // Fresh pages
+            *zero = bp;
+            return bp;
+        }
+    }
+
+    // Small requests come from slab runs, without a block header, once
+    // their class is common enough to fill one
+    if (size <= SLAB_MAX && slab_enabled && slab_ready(arena_get(), (size - 1) / dsize))
+    {
+        bp = slab_malloc(arena_get(), (size - 1) / dsize);
+        dbg_ensures(mm_checkheap(__LINE__));
+        return bp;
+    }
+
+    // Large requests may come from buddy zones; if no zone can be carved
+    // they take the regular path, which can reclaim and grow in place
+    if (buddy_min != 0 && size >= buddy_min && size + dsize <= (1UL << BUDDY_ZONE_ORDER))
+    {
+        bp = buddy_malloc(arena_get(), size);
+        if (bp != NULL)
+        {
+            dbg_ensures(mm_checkheap(__LINE__));
+            return bp;
+        }
+    }
 
-   // Block Size = 32 bytes
-   else if (size <= dsize)
-   {        
-        asize = min_block_size;
-   }
+    asize = adjust_size(size);
 
-   // Round up and adjust to meet alignment requirements    
-   else
-        asize = round_up(size+wsize, dsize);
+    // Serve exact-size requests from this thread's cache first
+    block = tcache_get(asize);
+    if (block != NULL)
+    {
+        bp = header_to_payload(block);
+        dbg_ensures(mm_checkheap(__LINE__));
+        return bp;
+    }
+
+    // Search this thread's arena for a fit, after taking back the
+    // blocks other threads have freed into it
+    arena = arena_get();
+    global_lock();
+    if (__atomic_load_n(&arena -> remote_count, __ATOMIC_RELAXED) != 0)
+    {
+        remote_drain(arena);
+    }
+    block = fast_pop(arena, asize);
+    if (block != NULL)
+    {
+        bp = header_to_payload(block);
+        tcache_refill(arena, asize);
+        global_unlock();
+        dbg_ensures(mm_checkheap(__LINE__));
+        return bp;
+    }
+    block = find_fit(arena, asize);
+    if (block == NULL)
+    {
+        // The top goes last, so blocks that realloc grows into it in
+        // place keep it after them. Taking it first drops syn-grow from
+        // 96% to 78% util, and syn-mix-realloc from 81% to 76%
+        block = top_take(arena, asize, 0);
+    }
 
-    // Search the free list for a fit
-    block = find_fit(asize);
+    // Before growing the heap, return cached and fastbin blocks, idle
+    // slab runs and idle buddy zones so they can coalesce
+    if (block == NULL && (tcache_drain() | fast_consolidate(arena)
+                          | slab_trim(arena) | buddy_trim(arena)))
+    {
+        block = find_fit(arena, asize);
+        if (block == NULL)
+            block = top_take(arena, asize, 0);
+    }
 
-    // If no fit is found, request more memory, and then and place the block
+    // If the top is too small, grow it, and then and place the block
     if (block == NULL)
     {  
-        extendsize = max(asize, chunksize);
+        extendsize = grow_size(arena, asize);
        
-        block = extend_heap(extendsize);
+        block = extend_heap(arena, extendsize);
         if (block == NULL) // extend_heap returns an error
         {
+            global_unlock();
             return bp;
         }
 
     }
 
-    place(block, asize);
+    *zero = place(arena, block, asize);
     bp = header_to_payload(block);
 
+    // The cache missed, so stock it with further exact fits
+    tcache_refill(arena, asize);
+    global_unlock();
+
     dbg_ensures(mm_checkheap(__LINE__));
     return bp;
-} 
+}
+
+/*
+ * <what does mmalloc do?>
+ * Allocates a block with size at least (size + dsize), rounded up to the nearest 16 bytes, with a minimum of 2*dsize. 
+ * Seeks a sufficiently-large unallocated block on the heap to be allocated.
+ * If no such block is found, extends heap by the maximum between the growth step (see grow_size) and (size + dsize) rounded up to the nearest 16 bytes, and then attempts to allocate all, or a part of, that memory.
+ * Returns NULL on failure, otherwise returns a pointer to such block.
+ * The allocated block will not be used for further allocations until freed.
+ */
+void *malloc(size_t size) 
+{
+    char *zero;
+
+    return malloc_fresh(size, &zero);
+}
 
 /*
  * <what does free do?>
  * Frees the block such that it is no longer allocated while still maintaining its size. Block will be available for use on malloc.
+ * A block owned by another thread's arena is queued for that arena without taking any lock.
  */
 void free(void *bp)
 {
-    block_t *temp;
-    int abit, sbit;
-
     if (bp == NULL)
     {
         return;
     }
 
-    block_t *block = payload_to_header(bp);
+    if (is_mapped(bp))
+    {
+        map_free(bp);
+        return;
+    }
+    if (is_slab(bp) || is_buddy(bp))
+    {
+        release_headerless(bp);
+        return;
+    }
+    free_regular(payload_to_header(bp));
+}
+
+/*
+ * free_sized: frees bp like free. size must be the size it was last
+ * allocated or reallocated with; this is only checked, since looking the
+ * block up by its header costs no more than trusting the size.
+ */
+void free_sized(void *bp, size_t size)
+{
+    dbg_requires(bp == NULL || size <= usable_size(bp));
+    free(bp);
+}
+
+/*
+ * malloc_usable: allocates like malloc and, if usable is not NULL, stores
+ * there the number of payload bytes the block really has, which is at
+ * least size. The caller may use all of them.
+ */
+void *malloc_usable(size_t size, size_t *usable)
+{
+    void *bp = malloc(size);
+
+    if (bp != NULL && usable != NULL)
+    {
+        *usable = usable_size(bp);
+    }
+    return bp;
+}
+
+/*
+ * free_block: marks an allocated block free, updates the ABIT of the
+ *             next block and coalesces it into the free lists of the
+ *             arena that owns it.
+ */
+static void free_block(block_t *block)
+{
+    block_t *temp;
+    int abit;
     size_t size = get_size(block);
 
-    // Extract ABIT and SBIT
+    // Extract ABIT
     abit = (block -> header) & ABIT;
-    sbit = (block -> header) & SBIT;
 
-    // Carry over ABIT and SBIT information over to the free block
-    write_header(block, size+abit+sbit, false);
+    // Carry over ABIT information over to the free block
+    write_header(block, size+abit, false);
     write_footer(block, size, false);
     temp = find_next(block);
 
     // Clear ABIT in the next block to indicate free block
-    temp->header = temp -> header & (~ABIT);
+    header_clear(temp, ABIT);
 
     //printSList();
-    coalesce(block);
+    grow_note_free(arena_of(block), size);
+    coalesce(arena_of(block), block);
 }
 
 /*
- * <what does realloc do?>
- * Returns a pointer to an allocated region of at least size bytes:
- *          if ptrv is NULL, then call malloc(size);
- *          if size == 0, then call free(ptr) and returns NULL;
- *          else allocates new region of memory, copies old data to new memory, and then free old block. Returns old block if realloc fails or returns new pointer on success.
+ * adjust_size: returns the block size that holds a payload of size bytes.
  */
-void *realloc(void *ptr, size_t size)
+static size_t adjust_size(size_t size)
 {
+    // Smallest Block Size = 16 bytes, a mini block
+    if (size <= wsize)
+        return min_block_size;
 
-    block_t *block = payload_to_header(ptr);
-    size_t copysize;
-    void *newptr;
-
-    // If size == 0, then free block and return NULL
-    if (size == 0)
-    {
-        free(ptr);
-        return NULL;
-    }
+    // Round up and adjust to meet alignment requirements
+    return round_up(size+wsize, dsize);
+}
 
-    // If ptr is NULL, then equivalent to malloc
-    if (ptr == NULL)
-    {
-        return malloc(size);
-    }
+/*
+ * resize_block: resizes an allocated block of the arena to asize bytes
+ *               without moving it. A shrink splits the tail off as a free
+ *               block; a grow absorbs a free next block or the front of
+ *               the top and, if the block then ends the arena's segment at
+ *               the break, extends the heap by the missing bytes only.
+ *               Returns false, leaving the block as it was, if neither fits.
+ */
+static bool resize_block(arena_t *arena, block_t *block, size_t asize)
+{
+    block_t *next, *grown;
+    size_t grow;
+    char *brk;
 
-    // Otherwise, proceed with reallocation
-    newptr = malloc(size);
-    // If malloc fails, the original block is left untouched
-    if (!newptr)
-    {
-        return NULL;
-    }
+    if (get_size(block) < asize)
+        absorb_next(arena, block, true);
 
-    // Copy the old data
-    copysize = get_payload_size(block); // gets size of old payload
-    if(size < copysize)
+    if (get_size(block) < asize && !top_absorb(arena, block, asize))
     {
-        copysize = size;
+        // Grow the heap by the missing bytes: the top, if it follows, is
+        // too small, and merges with the new space
+        next = find_next(block);
+        brk = (char *)mem_heap_hi() + 1;
+        if ((next != arena -> epilogue && next != arena -> top)
+            || (char *)arena -> epilogue + wsize != brk)
+            return false;
+        grow = asize - get_size(block);
+        if (next != arena -> epilogue && get_size(next) < grow)
+            grow -= get_size(next);
+        grown = extend_heap(arena, grow);
+        if (grown == NULL)
+            return false;
+        if (grown != next)
+        {
+            // Another arena took the break first
+            list_put(arena, grown);
+            return false;
+        }
+        absorb_next(arena, block, false);
+        if (get_size(block) < asize)
+            return false;
     }
-    memcpy(newptr, ptr, copysize);
 
-    // Free the old block
-    free(ptr);
-    
-   // mm_checkheap(__LINE__);
-    return newptr;
+    if (get_size(block) - asize >= min_block_size)
+        shrink_block(block, asize);
+    return true;
 }
 
 /*
- * <what does calloc do?>
- * Allocates a block with size at least (elements * size + dsize) through malloc, then initializes all bits in allocated memory to 0.
- * Returns NULL on failure.
+ * absorb_next: merges the next block into an allocated block. If listed,
+ *              the next block is only taken while it is on a free list;
+ *              otherwise the caller owns it. Returns true if it merged.
  */
-void *calloc(size_t elements, size_t size)
+static bool absorb_next(arena_t *arena, block_t *block, bool listed)
 {
-    void *bp;
-    size_t asize = elements * size;
+    block_t *next = find_next(block);
+    word_t header = header_load(next);
+    size_t nsize = extract_size(header);
+    int nIndex;
 
-    if (asize/elements != size)
-    {    
-        // Multiplication overflowed
-        return NULL;
-    }
-    
-    bp = malloc(asize);
-    if (bp == NULL)
+    if (listed)
     {
-        return NULL;
+        if (!is_listed(header))
+            return false;
+        nIndex = list_class(nsize);
+        class_lock(arena, nIndex);
+        // Re-check under the lock, as merge does
+        listed = ((header_load(next) ^ header) & ~(word_t)ABIT) == 0;
+        if (listed)
+            listDelete(arena, next);
+        class_unlock(arena, nIndex);
+        if (!listed)
+            return false;
     }
-    // Initialize all bits to 0
-    memset(bp, 0, asize);
 
-    return bp;
+    next -> header = 0;
+    write_header(block, get_size(block) + nsize, true);
+    check_merged(block);
+    fresh_raise(arena, (char *)find_next(block));
+    return true;
+}
+/*
+ * shrink_block: cuts an allocated block down to asize bytes and frees the
+ *               tail, which must be at least a mini block.
+ */
+static void shrink_block(block_t *block, size_t asize)
+{
+    size_t csize = get_size(block);
+    block_t *tail;
+
+    write_header(block, asize, true);
+    tail = find_next(block);
+    tail -> header = 0;
+    // The tail is allocated for a moment so free_block sees sound flags
+    write_header(tail, csize - asize, true);
+    header_set(tail, ABIT);
+    free_block(tail);
+}
+
+/*
+ * carve_run: cuts up to n allocated blocks of asize bytes, back to back,
+ *            from a free block that is on no list, storing their payloads
+ *            in out[]; the last one is placed, so a large enough tail goes
+ *            back to the free lists. Returns the number of blocks cut.
+ */
+static size_t carve_run(arena_t *arena, block_t *block, size_t asize, size_t n, void **out)
+{
+    size_t csize = get_size(block), k;
+    block_t *next;
+
+    if (n > csize / asize)
+        n = csize / asize;
+    for (k = 0; k + 1 < n; k++)
+    {
+        // The next header is payload garbage until the write below sets
+        // its ABIT
+        next = (block_t *)((char *)block + asize);
+        next -> header = 0;
+        write_header(block, asize, true);
+        out[k] = header_to_payload(block);
+        block = next;
+        csize -= asize;
+    }
+    write_header(block, csize, false);
+    place(arena, block, asize);
+    out[k] = header_to_payload(block);
+    return n;
+}
+
+/*
+ * free_run: frees the allocated blocks from first to last, which lie back
+ *           to back, as a single block that is coalesced once.
+ */
+static void free_run(arena_t *arena, block_t *first, block_t *last)
+{
+    block_t *next = find_next(last);
+    size_t size = (char *)next - (char *)first;
+
+    if (first == last)
+    {
+        free_block(first);
+        return;
+    }
+    write_header(first, size, false);
+    write_footer(first, size, false);
+    check_merged(first);
+    // The block after the run follows a free block
+    header_clear(next, ABIT);
+    grow_note_free(arena, size);
+    coalesce(arena, first);
+}
+
+/*
+ * move_payload: copies size bytes from src to dst like memcpy. Past
+ *               remap_min, if both share their offset in a page, the
+ *               whole pages in between are swapped with mem_remap instead,
+ *               which leaves src's pages holding dst's old contents. Pages
+ *               only move within the heap, so a mapping is always copied to.
+ */
+static void move_payload(void *dst, void *src, size_t size)
+{
+    size_t page = 1 << PAGE_SHIFT;
+    size_t head = -(uintptr_t)src & (page - 1);
+    size_t body;
+    bool moved;
+
+    if (remap_min == 0 || size < remap_min || size < head + page || is_mapped(dst)
+        || (((uintptr_t)dst ^ (uintptr_t)src) & (page - 1)) != 0)
+    {
+        memcpy(dst, src, size);
+        return;
+    }
+    body = (size - head) & ~(page - 1);
+
+    memlib_lock();
+    moved = mem_remap((char *)dst + head, (char *)src + head, body);
+    memlib_unlock();
+    if (!moved)
+    {
+        memcpy(dst, src, size);
+        return;
+    }
+    memcpy(dst, src, head);
+    memcpy((char *)dst + head + body, (char *)src + head + body, size - head - body);
+}
+
+/*
+ * <what does realloc do?>
+ * Returns a pointer to an allocated region of at least size bytes:
+ *          if ptrv is NULL, then call malloc(size);
+ *          if size == 0, then call free(ptr) and returns NULL;
+ *          if the block can be resized where it is, returns ptr;
+ *          else allocates new region of memory, copies old data to new memory, and then free old block. Returns old block if realloc fails or returns new pointer on success.
+ */
+void *realloc(void *ptr, size_t size)
+{
+
+    size_t copysize;
+    void *newptr;
+    block_t *block;
+    bool resized;
+
+    // If size == 0, then free block and return NULL
+    if (size == 0)
+    {
+        free(ptr);
+        return NULL;
+    }
+
+    // If ptr is NULL, then equivalent to malloc
+    if (ptr == NULL)
+    {
+        return malloc(size);
+    }
+
+    // A mapping that stays huge is resized by the kernel, without a copy
+    if (is_mapped(ptr) && mmap_min != 0 && size >= mmap_min)
+    {
+        newptr = map_realloc(ptr, size);
+        if (newptr != NULL)
+            return newptr;
+    }
+
+    // Resize in place if the block belongs to this thread's arena
+    block = payload_to_header(ptr);
+    if (!is_mapped(ptr) && !is_slab(ptr) && !is_buddy(ptr) && arena_of(block) == arena_get()
+        && (size > SLAB_MAX || !slab_enabled))
+    {
+        global_lock();
+        resized = resize_block(arena_of(block), block, adjust_size(size));
+        global_unlock();
+        if (resized)
+        {
+            dbg_ensures(mm_checkheap(__LINE__));
+            return ptr;
+        }
+    }
+
+    // Otherwise, proceed with reallocation. A payload that grows huge
+    // moves to a page boundary, so that its next moves remap pages
+    if (remap_min != 0 && size >= remap_min)
+        newptr = memalign(1 << PAGE_SHIFT, size);
+    else
+        newptr = malloc(size);
+    // If malloc fails, the original block is left untouched
+    if (!newptr)
+    {
+        return NULL;
+    }
+
+    // Copy the old data
+    copysize = usable_size(ptr); // gets size of old payload
+    if(size < copysize)
+    {
+        copysize = size;
+    }
+    move_payload(newptr, ptr, copysize);
+
+    // Free the old block
+    free(ptr);
+    
+   // mm_checkheap(__LINE__);
+    return newptr;
+}
+
+/*
+ * <what does calloc do?>
+ * Allocates a block with size at least (elements * size + dsize) through malloc, then initializes all bits in allocated memory to 0.
+ * Bytes carved from never-used heap or a new mapping are zero already and are not cleared again.
+ * Returns NULL on failure.
+ */
+void *calloc(size_t elements, size_t size)
+{
+    char *bp, *zero, *last;
+    size_t asize;
+
+    if (elements != 0 && size > SIZE_MAX / elements)
+    {    
+        // Multiplication overflowed
+        return NULL;
+    }
+    asize = elements * size;
+    
+    bp = malloc_fresh(asize, &zero);
+    if (bp == NULL)
+    {
+        return NULL;
+    }
+    // Initialize all bits to 0, up to where the block is fresh
+    if (zero == NULL || zero > bp + asize)
+    {
+        zero = bp + asize;
+    }
+    memset(bp, 0, zero - bp);
+
+    // The last word of a fresh heap block may hold a free block's footer
+    if (zero < bp + asize && !is_mapped(bp))
+    {
+        last = bp + get_payload_size(payload_to_header(bp)) - wsize;
+        if (last < zero)
+            last = zero;
+        if (last < bp + asize)
+            memset(last, 0, bp + asize - last);
+    }
+
+    return bp;
+}
+
+/*
+ * memalign: allocates a block of at least size bytes whose payload is a
+ * multiple of align, which must be a power of two. Sizes that round up to
+ * a slab class are served by a slab object, aligned by the class's size;
+ * huge sizes get a mapping, which starts on a page. Any other request is
+ * carved on the boundary from the heap, the space in front of it going
+ * back to the free lists, so no padding is kept with the block.
+ * Returns NULL, with errno set to EINVAL or ENOMEM, on failure.
+ */
+void *memalign(size_t align, size_t size)
+{
+    size_t page = 1 << PAGE_SHIFT;
+    arena_t *arena;
+    block_t *block;
+    void *bp = NULL;
+
+    if (align == 0 || (align & (align - 1)) != 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (align <= dsize)
+    {
+        return malloc(size);
+    }
+    if (heap_start == NULL)
+    {
+        mm_init();
+    }
+    if (size == 0)
+    {
+        return NULL;
+    }
+
+    // Slab objects of a class that is a multiple of align lie on its
+    // boundaries, since runs start on a page plus SLAB_HEADER bytes
+    if (slab_enabled && align <= SLAB_HEADER && round_up(size, align) <= SLAB_MAX)
+    {
+        bp = slab_malloc(arena_get(), (round_up(size, align) - 1) / dsize);
+        dbg_ensures(mm_checkheap(__LINE__));
+        return bp;
+    }
+    if (mmap_min != 0 && size >= mmap_min && align <= page)
+    {
+        bp = map_malloc(size);
+        if (bp != NULL)
+            return bp;
+    }
+
+    // Huge payloads start on a page anyway, so that realloc can remap them
+    if (remap_min != 0 && size >= remap_min && align < page)
+    {
+        align = page;
+    }
+    arena = arena_get();
+    global_lock();
+    block = carve_aligned(arena, align, size, true);
+    global_unlock();
+    if (block == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    bp = header_to_payload(block);
+    dbg_ensures(((uintptr_t)bp & (align - 1)) == 0);
+    dbg_ensures(mm_checkheap(__LINE__));
+    return bp;
+}
+
+/*
+ * posix_memalign: stores in *memptr a block of at least size bytes aligned
+ * to align, which must be a power of two multiple of sizeof(void *).
+ * Returns 0, EINVAL for a bad align, or ENOMEM leaving *memptr alone.
+ */
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    void *bp;
+
+    if (align == 0 || align % sizeof(void *) != 0 || (align & (align - 1)) != 0)
+    {
+        return EINVAL;
+    }
+    bp = memalign(align, size);
+    if (bp == NULL && size != 0)
+    {
+        return ENOMEM;
+    }
+    *memptr = bp;
+    return 0;
+}
+
+/*
+ * aligned_alloc: the C11 form of memalign. Returns NULL for an align that
+ * is not a power of two.
+ */
+void *aligned_alloc(size_t align, size_t size)
+{
+    return memalign(align, size);
+}
+
+/*
+ * malloc_batch: allocates n blocks of size bytes each into out[], carving
+ * as many as fit from each free block found, or all of them from one heap
+ * extension. Before growing, the arena reclaims what malloc would; if the
+ * heap cannot grow for all that are left, they are allocated one by one.
+ * Returns the number allocated, which is less than n only if malloc fails
+ * too; the first ones of out[] are filled.
+ */
+size_t malloc_batch(size_t size, size_t n, void **out)
+{
+    size_t asize, want, k = 0;
+    arena_t *arena;
+    block_t *block;
+    bool reclaimed = false;
+
+    if (heap_start == NULL)
+    {
+        mm_init();
+    }
+
+    // Headerless and huge requests take their own paths
+    if (size == 0 || (size <= SLAB_MAX && slab_enabled)
+        || (buddy_min != 0 && size >= buddy_min)
+        || (mmap_min != 0 && size >= mmap_min))
+    {
+        for (k = 0; k < n && (out[k] = malloc(size)) != NULL; k++)
+            ;
+        return k;
+    }
+
+    asize = adjust_size(size);
+    while (k < n && (block = tcache_get(asize)) != NULL)
+        out[k++] = header_to_payload(block);
+    if (k == n)
+        return k;
+
+    arena = arena_get();
+    global_lock();
+    if (__atomic_load_n(&arena -> remote_count, __ATOMIC_RELAXED) != 0)
+    {
+        remote_drain(arena);
+    }
+    while (k < n)
+    {
+        // Room for all that are left, else room for at least one, else,
+        // once cached and fastbin blocks, idle slab runs and idle buddy
+        // zones are back, a heap extension for all that are left; a count
+        // whose bytes overflow looks for one at a time
+        want = (n - k <= SIZE_MAX / asize) ? asize * (n - k) : asize;
+        block = find_fit(arena, want);
+        if (block == NULL && want != asize)
+            block = find_fit(arena, asize);
+        if (block == NULL)
+            block = top_take(arena, want, 0);
+        if (block == NULL && !reclaimed)
+        {
+            reclaimed = true;
+            if (tcache_drain() | fast_consolidate(arena) | slab_trim(arena) | buddy_trim(arena))
+                continue;
+        }
+        if (block == NULL)
+            block = extend_heap(arena, grow_size(arena, want));
+        if (block == NULL)
+            break;
+        k += carve_run(arena, block, asize, n - k, &out[k]);
+    }
+    global_unlock();
+
+    // The heap could not grow for the rest at once: malloc may still find
+    // room for them one by one
+    while (k < n && (out[k] = malloc(size)) != NULL)
+        k++;
+
+    dbg_ensures(mm_checkheap(__LINE__));
+    return k;
+}
+
+/*
+ * free_batch: frees the n blocks of ptrs[], which may hold NULLs. Blocks
+ * of this thread's arena are sorted by address in groups of BATCH_SORT,
+ * and every run of adjacent ones is freed as one block. ptrs[] is left
+ * as it was.
+ */
+void free_batch(void **ptrs, size_t n)
+{
+    void *sorted[BATCH_SORT], *bp;
+    arena_t *arena = arena_get();
+    block_t *first, *last;
+    size_t i, j, m;
+
+    for (i = 0; i < n; )
+    {
+        // Gather this thread's heap blocks, freeing the others one by one
+        for (m = 0; i < n && m < BATCH_SORT; i++)
+        {
+            bp = ptrs[i];
+            if (bp == NULL)
+                continue;
+            if (is_mapped(bp) || is_slab(bp) || is_buddy(bp)
+                || arena_of(payload_to_header(bp)) != arena)
+            {
+                free(bp);
+                continue;
+            }
+            // Insertion sort: the group is small
+            for (j = m++; j > 0 && (char *)sorted[j - 1] > (char *)bp; j--)
+                sorted[j] = sorted[j - 1];
+            sorted[j] = bp;
+        }
+
+        global_lock();
+        for (j = 0; j < m; j++)
+        {
+            first = last = payload_to_header(sorted[j]);
+            while (j + 1 < m && find_next(last) == payload_to_header(sorted[j + 1]))
+                last = payload_to_header(sorted[++j]);
+            free_run(arena, first, last);
+        }
+        global_unlock();
+    }
+    dbg_ensures(mm_checkheap(__LINE__));
+}
+
+/******** The remaining content below are helper and debug routines ********/
+
+/*
+ * tcache_bin: returns the thread cache bin for a block of the given size,
+ *             or -1 if blocks of this size are not cached.
+ */
+static int tcache_bin(size_t size)
+{
+    int bin = getList(size) + 1;
+
+    if (bin >= TCACHE_BINS)
+        return -1;
+    return bin;
+}
+
+/*
+ * tcache_sync: drops the cache contents if they belong to a heap that
+ *              mm_init has since discarded.
+ */
+static void tcache_sync(void)
+{
+    int i;
+
+    if (tcache.gen == heap_gen)
+        return;
+    for (i = 0; i < TCACHE_BINS; i++)
+    {
+        tcache.bin[i] = NULL;
+        tcache.count[i] = 0;
+    }
+    tcache.gen = heap_gen;
+}
+
+/*
+ * tcache_get: removes and returns a cached block of exactly asize bytes,
+ *             or NULL if the bin holds none. The block is still marked
+ *             allocated, so no header or list work is needed.
+ */
+static block_t *tcache_get(size_t asize)
+{
+    int bin = tcache_bin(asize);
+    block_t **link;
+    block_t *block;
+
+    if (bin < 0)
+        return NULL;
+    tcache_sync();
+
+    link = &tcache.bin[bin];
+    while ((block = *link) != NULL)
+    {
+        if (get_size(block) == asize)
+        {
+            *link = NEXTBLOCK;
+            tcache.count[bin]--;
+            return block;
+        }
+        link = &(block -> payload.links.next);
+    }
+    return NULL;
+}
+
+/*
+ * tcache_put: pushes an allocated block onto the given cache bin.
+ * Returns false if the bin is full; the caller then flushes it.
+ */
+static bool tcache_put(int bin, block_t *block)
+{
+    tcache_sync();
+    if (tcache.count[bin] >= TCACHE_COUNT)
+        return false;
+
+    NEXTBLOCK = tcache.bin[bin];
+    tcache.bin[bin] = block;
+    tcache.count[bin]++;
+    return true;
+}
+
+/*
+ * tcache_refill: after a miss for asize, moves up to TCACHE_REFILL blocks
+ *                of exactly asize bytes from the fastbin, then the free
+ *                lists, into the cache. Inexact fits are left alone, so
+ *                refilling never splits blocks or grows the heap.
+ */
+static void tcache_refill(arena_t *arena, size_t asize)
+{
+    int bin = tcache_bin(asize);
+    int i;
+    block_t *block;
+
+    if (bin < 0)
+        return;
+
+    for (i = 0; i < TCACHE_REFILL && tcache.count[bin] < TCACHE_COUNT; i++)
+    {
+        block = fast_pop(arena, asize);
+        if (block == NULL)
+        {
+            block = take_exact(arena, asize);
+            if (block == NULL)
+                return;
+            place(arena, block, asize);
+        }
+        NEXTBLOCK = tcache.bin[bin];
+        tcache.bin[bin] = block;
+        tcache.count[bin]++;
+    }
+}
+
+/*
+ * tcache_flush: keeps the newest keep blocks of a bin and returns the
+ *               rest to their arenas, coalescing them as a batch.
+ */
+static void tcache_flush(int bin, unsigned int keep)
+{
+    block_t *block = tcache.bin[bin];
+    block_t *next;
+    unsigned int i;
+
+    if (keep == 0)
+    {
+        tcache.bin[bin] = NULL;
+    }
+    else
+    {
+        for (i = 1; i < keep; i++)
+            block = NEXTBLOCK;
+        next = NEXTBLOCK;
+        NEXTBLOCK = NULL;
+        block = next;
+    }
+    tcache.count[bin] = keep;
+
+    while (block != NULL)
+    {
+        next = NEXTBLOCK;
+        release_block(block);
+        block = next;
+    }
+}
+
+/*
+ * tcache_drain: flushes every bin back to the free lists.
+ * Returns true if any block was released.
+ */
+static bool tcache_drain(void)
+{
+    bool released = false;
+    int i;
+
+    tcache_sync();
+    for (i = 0; i < TCACHE_BINS; i++)
+    {
+        if (tcache.count[i] != 0)
+        {
+            released = true;
+            tcache_flush(i, 0);
+        }
+    }
+    return released;
+}
+
+/*
+ * remote_push: queues a block freed by a thread of another arena.
+ *              Wait-free: one exchange publishes the block, after which
+ *              the previous head is linked to it.
+ *              Returns the number of blocks now queued.
+ */
+static unsigned long remote_push(arena_t *arena, block_t *block)
+{
+    block_t *prev;
+
+    __atomic_store_n(&NEXTBLOCK, NULL, __ATOMIC_RELAXED);
+    prev = __atomic_exchange_n(&arena -> remote_head, block, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev -> payload.links.next, block, __ATOMIC_RELEASE);
+    return __atomic_add_fetch(&arena -> remote_count, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * remote_pop: takes the oldest block off the arena's remote queue.
+ *             Must be called with remote_lock held. Returns NULL if the
+ *             queue is empty, or if a producer is between its exchange
+ *             and its link; that block is picked up by a later drain.
+ */
+static block_t *remote_pop(arena_t *arena)
+{
+    block_t *tail = arena -> remote_tail;
+    block_t *next = __atomic_load_n(&tail -> payload.links.next, __ATOMIC_ACQUIRE);
+
+    // Step over the stub
+    if (tail == &arena -> remote_stub)
+    {
+        if (next == NULL)
+            return NULL;
+        arena -> remote_tail = next;
+        tail = next;
+        next = __atomic_load_n(&tail -> payload.links.next, __ATOMIC_ACQUIRE);
+    }
+    if (next != NULL)
+    {
+        arena -> remote_tail = next;
+        return tail;
+    }
+
+    // tail is the last block: requeue the stub behind it so it can go
+    if (tail != __atomic_load_n(&arena -> remote_head, __ATOMIC_ACQUIRE))
+        return NULL;
+    remote_push(arena, &arena -> remote_stub);
+    __atomic_sub_fetch(&arena -> remote_count, 1, __ATOMIC_RELAXED);
+    next = __atomic_load_n(&tail -> payload.links.next, __ATOMIC_ACQUIRE);
+    if (next == NULL)
+        return NULL;
+    arena -> remote_tail = next;
+    return tail;
+}
+
+/*
+ * remote_drain: frees every block queued for the arena into its free lists.
+ *               Only one thread drains at a time; the others skip it.
+ *               The caller holds the global lock under LOCK_GLOBAL.
+ */
+static void remote_drain(arena_t *arena)
+{
+    block_t *block;
+
+    if (!lock_try(&arena -> remote_lock))
+        return;
+    while ((block = remote_pop(arena)) != NULL)
+    {
+        __atomic_sub_fetch(&arena -> remote_count, 1, __ATOMIC_RELAXED);
+        if (is_slab(header_to_payload(block)) || is_buddy(header_to_payload(block)))
+            free_headerless(header_to_payload(block));
+        else
+            free_block(block);
+    }
+    lock_release(&arena -> remote_lock);
+}
+
+/*
+ * release_block: frees a block into the calling thread's arena, parking
+ *                it in a fastbin if it is small enough, or queues it for
+ *                its owning arena.
+ */
+static void release_block(block_t *block)
+{
+    arena_t *arena = arena_of(block);
+
+    if (arena != arena_get())
+    {
+        remote_push(arena, block);
+        return;
+    }
+    if (get_size(block) <= FAST_MAX)
+    {
+        fast_push(arena, block);
+        return;
+    }
+    free_block(block);
+}
+
+/*
+ * fast_push: parks an allocated block in the arena's fastbin for its size,
+ *            without touching its header or its neighbours.
+ */
+static void fast_push(arena_t *arena, block_t *block)
+{
+    int i = get_size(block) / dsize - 1;
+
+    fast_lock(arena);
+    NEXTBLOCK = arena -> fast[i];
+    arena -> fast[i] = block;
+    arena -> fast_count++;
+    fast_unlock(arena);
+}
+
+/*
+ * fast_pop: takes a block of exactly asize bytes from the arena's
+ *           fastbins, ready to hand out, or returns NULL.
+ */
+static block_t *fast_pop(arena_t *arena, size_t asize)
+{
+    int i = asize / dsize - 1;
+    block_t *block;
+
+    if (asize > FAST_MAX || arena -> fast[i] == NULL)
+        return NULL;
+    fast_lock(arena);
+    block = arena -> fast[i];
+    if (block != NULL)
+    {
+        arena -> fast[i] = NEXTBLOCK;
+        arena -> fast_count--;
+    }
+    fast_unlock(arena);
+    return block;
+}
+
+/*
+ * fast_consolidate: frees every fastbin block of the arena into the free
+ *                   lists, coalescing it with its neighbours.
+ *                   Returns true if any block was freed.
+ */
+static bool fast_consolidate(arena_t *arena)
+{
+    block_t *bins[FAST_BINS];
+    block_t *block, *next;
+    int i;
+
+    if (arena -> fast_count == 0)
+        return false;
+    fast_lock(arena);
+    memcpy(bins, arena -> fast, sizeof(bins));
+    memset(arena -> fast, 0, sizeof(arena -> fast));
+    arena -> fast_count = 0;
+    fast_unlock(arena);
+
+    for (i = 0; i < FAST_BINS; i++)
+    {
+        for (block = bins[i]; block != NULL; block = next)
+        {
+            next = NEXTBLOCK;
+            free_block(block);
+        }
+    }
+    return true;
+}
+
+/*
+ * carve_aligned: allocates a block from the arena whose payload starts on
+ *                an align boundary and holds at least size bytes. The
+ *                space in front of the boundary is split off as a free
+ *                block. When the heap has to grow at its end, it grows
+ *                just enough for the boundary, so repeated carves pack
+ *                tightly. Unless extend is set, only free space is used.
+ *                Returns NULL if the heap cannot or may not grow.
+ */
+static block_t *carve_aligned(arena_t *arena, size_t align, size_t size, bool extend)
+{
+    size_t asize = round_up(size + wsize, dsize);
+    size_t csize, lead, grow;
+    block_t *block, *aligned, *top;
+    block_t *end = arena -> epilogue;
+
+    block = take_aligned(arena, align, asize);
+    if (block == NULL)
+        block = top_take(arena, asize, align);
+    if (block == NULL && !extend)
+        return NULL;
+    if (block == NULL)
+    {
+        // The new block will start at the top, else at the end header, if
+        // the arena owns the break; this is only a hint, the lead is
+        // checked again below
+        grow = asize + align;
+        top = arena -> top;
+        if (end != NULL && (char *)end + wsize == (char *)mem_heap_hi() + 1)
+        {
+            grow = aligned_lead((top != NULL) ? top : end, align) + asize;
+            if (top != NULL && get_size(top) < grow)
+                grow -= get_size(top);
+        }
+        block = extend_heap(arena, grow_size(arena, grow));
+        if (block == NULL)
+            return NULL;
+        if (aligned_lead(block, align) + asize > get_size(block))
+        {
+            list_put(arena, block);
+            block = extend_heap(arena, asize + align);
+            if (block == NULL)
+                return NULL;
+        }
+    }
+
+    lead = aligned_lead(block, align);
+    if (lead != 0)
+    {
+        // The leading fragment keeps the flags of the block; it is at
+        // least a mini block, since payloads are 16-byte aligned
+        csize = get_size(block);
+        aligned = (block_t *)((char *)block + lead);
+        aligned -> header = 0;
+        write_header(block, lead, false);
+        write_footer(block, lead, false);
+        write_header(aligned, csize - lead, false);
+        write_footer(aligned, csize - lead, false);
+        list_put(arena, block);
+        block = aligned;
+    }
+    place(arena, block, asize);
+    return block;
+}
+
+/*
+ * take_aligned: takes a free block off the arena's lists that has room for
+ *               asize bytes from its first align boundary on, looking at no
+ *               more than THRESHFIT blocks (one with ENGINE_TLSF).
+ *               Returns NULL if none is found.
+ */
+static block_t *take_aligned(arena_t *arena, size_t align, size_t asize)
+{
+    block_t *block;
+    int i = getList(asize), t = 0;
+
+    if (engine == ENGINE_TLSF)
+    {
+        // Any block of asize + align bytes has room after its boundary
+        return tlsf_find_fit(arena, asize + align);
+    }
+    for (i = (i < 0) ? 0 : i; i < LISTSIZE; i++)
+    {
+        if (arena -> listHeader[i] == NULL)
+            continue;
+        class_lock(arena, i);
+        if (i == TREE_CLASS)
+        {
+            // The best fit for asize, else one that has room wherever
+            // its boundary falls
+            block = treap_fit(arena -> listHeader[i], asize);
+            if (block != NULL && aligned_lead(block, align) + asize > get_size(block))
+                block = treap_fit(arena -> listHeader[i], asize + align);
+            if (block != NULL)
+                listDelete(arena, block);
+            class_unlock(arena, i);
+            return block;
+        }
+        for (block = arena -> listHeader[i]; block != NULL && t++ < THRESHFIT; block = link_next(block))
+        {
+            if (aligned_lead(block, align) + asize <= get_size(block))
+            {
+                listDelete(arena, block);
+                class_unlock(arena, i);
+                return block;
+            }
+        }
+        class_unlock(arena, i);
+    }
+    return NULL;
+}
+
+/*
+ * aligned_lead: returns the distance from the block's payload to the next
+ *               align boundary. Boundaries are absolute addresses; up to a
+ *               page they are also offsets from heap_lo.
+ */
+static size_t aligned_lead(block_t *block, size_t align)
+{
+    uintptr_t addr = (uintptr_t)header_to_payload(block);
+    return round_up(addr, align) - addr;
+}
+/*
+ * is_slab: returns true if the payload pointer lies in a slab run.
+ */
+static bool is_slab(void *bp)
+{
+    return page_arena[((char *)bp - heap_lo) >> PAGE_SHIFT] & PAGE_SLAB;
+}
+
+/*
+ * slab_of: returns the run holding a slab object.
+ */
+static slab_t *slab_of(void *bp)
+{
+    return (slab_t *)((char *)heap_lo + ((((char *)bp - heap_lo) >> PAGE_SHIFT) << PAGE_SHIFT));
+}
+
+/*
+ * slab_new: carves a run for slab class cls out of the arena's heap and
+ *           makes it the class's first partial run.
+ *           Returns NULL if the heap cannot grow.
+ */
+static slab_t *slab_new(arena_t *arena, int cls)
+{
+    block_t *block = carve_aligned(arena, 1 << PAGE_SHIFT, SLAB_RUN, true);
+    slab_t *run;
+    int i;
+
+    if (block == NULL)
+        return NULL;
+    run = header_to_payload(block);
+    run -> osize = (cls + 1) * dsize;
+    run -> nslots = (SLAB_RUN - SLAB_HEADER) / run -> osize;
+    run -> nfree = run -> nslots;
+    run -> cls = cls;
+    memset(run -> map, 0, sizeof(run -> map));
+    for (i = 0; i < run -> nslots; i++)
+        run -> map[i / 64] |= 1UL << (i % 64);
+
+    run -> prev = NULL;
+    run -> next = arena -> slabs[cls];
+    if (run -> next != NULL)
+        run -> next -> prev = run;
+    arena -> slabs[cls] = run;
+    page_arena[((char *)run - heap_lo) >> PAGE_SHIFT] |= PAGE_SLAB;
+    return run;
+}
+
+/*
+ * slab_malloc: returns a free object of slab class cls from the arena,
+ *              starting a new run if every run is full.
+ *              Returns NULL if the heap cannot grow.
+ */
+static void *slab_malloc(arena_t *arena, int cls)
+{
+    slab_t *run;
+    int w, slot;
+
+    global_lock();
+    slab_lock(arena, cls);
+    run = arena -> slabs[cls];
+    if (run == NULL)
+        run = slab_new(arena, cls);
+    if (run == NULL)
+    {
+        slab_unlock(arena, cls);
+        global_unlock();
+        return NULL;
+    }
+
+    for (w = 0; run -> map[w] == 0; w++)
+        ;
+    slot = w * 64 + __builtin_ctzl(run -> map[w]);
+    run -> map[w] &= run -> map[w] - 1;
+
+    // A full run leaves the partial list until an object comes back
+    if (--run -> nfree == 0)
+    {
+        arena -> slabs[cls] = run -> next;
+        if (run -> next != NULL)
+            run -> next -> prev = NULL;
+    }
+    slab_unlock(arena, cls);
+    global_unlock();
+    return (char *)run + SLAB_HEADER + slot * run -> osize;
+}
+
+/*
+ * slab_ready: tells whether a request of slab class cls goes to a slab run.
+ *             The first requests of a class, as many as a run holds, get
+ *             regular blocks instead, so that a class with few objects
+ *             does not tie up a whole run.
+ */
+static bool slab_ready(arena_t *arena, int cls)
+{
+    unsigned long slots = (SLAB_RUN - SLAB_HEADER) / ((cls + 1) * dsize);
+
+    if (arena -> slab_warm[cls] >= slots)
+        return true;
+#if LOCKING == LOCK_NONE
+    arena -> slab_warm[cls]++;
+#else
+    __atomic_fetch_add(&arena -> slab_warm[cls], 1, __ATOMIC_RELAXED);
+#endif
+    return false;
+}
+
+/*
+ * slab_free: returns an object to its run, which must belong to the
+ *            calling thread's arena. An empty run goes back to the heap,
+ *            unless it is the only partial run of its class.
+ *            The caller holds the global lock under LOCK_GLOBAL.
+ */
+static void slab_free(slab_t *run, void *bp)
+{
+    arena_t *arena = arena_of(payload_to_header(bp));
+    int cls = run -> cls;
+    int slot = ((char *)bp - (char *)run - SLAB_HEADER) / run -> osize;
+
+    slab_lock(arena, cls);
+    dbg_assert(!(run -> map[slot / 64] & (1UL << (slot % 64))));
+    run -> map[slot / 64] |= 1UL << (slot % 64);
+
+    if (run -> nfree++ == 0)
+    {
+        // Full run turns partial
+        run -> prev = NULL;
+        run -> next = arena -> slabs[cls];
+        if (run -> next != NULL)
+            run -> next -> prev = run;
+        arena -> slabs[cls] = run;
+    }
+    else if (run -> nfree == run -> nslots && (run -> next != NULL || run -> prev != NULL))
+    {
+        // Empty run, and not the last one of its class
+        slab_unlink(arena, run);
+        slab_unlock(arena, cls);
+        slab_release(run);
+        return;
+    }
+    slab_unlock(arena, cls);
+}
+
+/*
+ * slab_unlink: removes a run from its class's partial list.
+ */
+static void slab_unlink(arena_t *arena, slab_t *run)
+{
+    if (run -> prev != NULL)
+        run -> prev -> next = run -> next;
+    else
+        arena -> slabs[run -> cls] = run -> next;
+    if (run -> next != NULL)
+        run -> next -> prev = run -> prev;
+}
+
+/*
+ * slab_release: frees the heap block of an empty, unlinked run.
+ */
+static void slab_release(slab_t *run)
+{
+    page_arena[((char *)run - heap_lo) >> PAGE_SHIFT] &= ~PAGE_SLAB;
+    free_block(payload_to_header(run));
+}
+
+/*
+ * slab_trim: releases the empty run each slab class keeps around.
+ *            Returns true if any run was released.
+ */
+static bool slab_trim(arena_t *arena)
+{
+    bool released = false;
+    slab_t *run;
+    int cls;
+
+    for (cls = 0; cls < SLAB_CLASSES; cls++)
+    {
+        run = arena -> slabs[cls];
+        if (run == NULL)
+            continue;
+        slab_lock(arena, cls);
+        run = arena -> slabs[cls];
+        if (run != NULL && run -> nfree == run -> nslots)
+            slab_unlink(arena, run);
+        else
+            run = NULL;
+        slab_unlock(arena, cls);
+        if (run != NULL)
+        {
+            slab_release(run);
+            released = true;
+        }
+    }
+    return released;
+}
+
+/*
+ * usable_size: returns the number of payload bytes of an allocated pointer.
+ */
+static size_t usable_size(void *bp)
+{
+    if (is_mapped(bp))
+        return mappings[map_slot(bp)].size;
+    if (is_slab(bp))
+        return slab_of(bp) -> osize;
+    if (is_buddy(bp))
+        return (1UL << (((block_t *)((char *)bp - dsize)) -> header & 0xff)) - dsize;
+    return get_payload_size(payload_to_header(bp));
+}
+
+/*
+ * free_headerless: frees a slab object or buddy block of the calling
+ *                  thread's arena. The caller holds the global lock
+ *                  under LOCK_GLOBAL.
+ */
+static void free_headerless(void *bp)
+{
+    if (is_slab(bp))
+        slab_free(slab_of(bp), bp);
+    else
+        buddy_free(arena_of(payload_to_header(bp)), bp);
+}
+
+/*
+ * release_headerless: frees a slab object or buddy block, queueing it for
+ *                     its owner if it belongs to another thread's arena.
+ */
+static void release_headerless(void *bp)
+{
+    arena_t *arena = arena_of(payload_to_header(bp));
+
+    if (arena != arena_get())
+    {
+        // Queued like any block: the link lands in the object itself
+        if (remote_push(arena, payload_to_header(bp)) >= REMOTE_DRAIN)
+        {
+            global_lock();
+            remote_drain(arena);
+            global_unlock();
+        }
+        return;
+    }
+    global_lock();
+    free_headerless(bp);
+    global_unlock();
+}
+
+/*
+ * free_regular: frees a regular heap block through the thread cache, the
+ *               owner's remote queue or the free lists.
+ */
+static void free_regular(block_t *block)
+{
+    int bin;
+    arena_t *arena;
+
+    // Park the block in this thread's cache if its bin has room
+    bin = tcache_bin(get_size(block));
+    if (bin >= 0 && tcache_put(bin, block))
+    {
+        return;
+    }
+
+    arena = arena_of(block);
+    if (bin < 0 && arena != arena_get())
+    {
+        // Hand the block to its owner; if the owner has not allocated
+        // for a while, drain its queue on its behalf
+        if (remote_push(arena, block) >= REMOTE_DRAIN)
+        {
+            global_lock();
+            remote_drain(arena);
+            global_unlock();
+        }
+        return;
+    }
+
+    global_lock();
+    if (bin >= 0)
+    {
+        // The bin is full: flush its older half, then cache the block
+        tcache_flush(bin, TCACHE_COUNT/2);
+        tcache_put(bin, block);
+    }
+    else
+    {
+        free_block(block);
+    }
+    global_unlock();
+}
+
+/*
+ * is_mapped: returns true if the payload pointer is not in the heap, i.e.
+ *            it is a direct-mapped block.
+ */
+static bool is_mapped(void *bp)
+{
+    return (char *)bp < heap_lo || (char *)bp > (char *)mem_heap_hi();
+}
+
+/*
+ * map_slot: returns the side table slot of a direct-mapped block, or the
+ *           empty slot where it would go.
+ */
+static size_t map_slot(void *bp)
+{
+    size_t i = ((uintptr_t)bp >> PAGE_SHIFT) & (MAP_SLOTS - 1);
+
+    while (mappings[i].start != NULL && mappings[i].start != bp)
+        i = (i + 1) & (MAP_SLOTS - 1);
+    return i;
+}
+
+/*
+ * map_malloc: returns a new direct-mapped block of at least size bytes, or
+ *             NULL if the side table is half full or the mapping fails.
+ */
+static void *map_malloc(size_t size)
+{
+    size_t len = round_up(size, 1 << PAGE_SHIFT);
+    char *bp = NULL;
+
+    memlib_lock();
+    if (mapping_count < MAP_SLOTS / 2)
+        bp = mem_map(len);
+    if (bp != NULL)
+    {
+        mappings[map_slot(bp)] = (mapping_t){bp, len};
+        mapping_count++;
+    }
+    memlib_unlock();
+    return bp;
+}
+
+/*
+ * map_realloc: resizes a direct-mapped block to at least size bytes,
+ *              letting the kernel move its pages. Returns the new payload,
+ *              or NULL leaving the block as it was.
+ */
+static void *map_realloc(void *bp, size_t size)
+{
+    size_t len = round_up(size, 1 << PAGE_SHIFT);
+    char *moved;
+
+    memlib_lock();
+    moved = mem_mremap(bp, len);
+    if (moved != NULL)
+    {
+        map_remove(map_slot(bp));
+        mappings[map_slot(moved)] = (mapping_t){moved, len};
+    }
+    memlib_unlock();
+    return moved;
+}
+
+/*
+ * map_free: unmaps a direct-mapped block, returning its pages at once.
+ */
+static void map_free(void *bp)
+{
+    memlib_lock();
+    map_remove(map_slot(bp));
+    mapping_count--;
+    mem_unmap(bp);
+    memlib_unlock();
+}
+
+/*
+ * map_remove: empties a side table slot, moving later entries of its probe
+ *             sequence back so that every entry stays reachable.
+ */
+static void map_remove(size_t i)
+{
+    size_t j = i, home;
+
+    mappings[i].start = NULL;
+    for (;;)
+    {
+        j = (j + 1) & (MAP_SLOTS - 1);
+        if (mappings[j].start == NULL)
+            return;
+        home = ((uintptr_t)mappings[j].start >> PAGE_SHIFT) & (MAP_SLOTS - 1);
+        // Move the entry if its home is not cyclically within (i, j]
+        if (((j - home) & (MAP_SLOTS - 1)) >= ((j - i) & (MAP_SLOTS - 1)))
+        {
+            mappings[i] = mappings[j];
+            mappings[j].start = NULL;
+            i = j;
+        }
+    }
+}
+
+/*
+ * is_buddy: returns true if the payload pointer lies in a buddy zone.
+ */
+static bool is_buddy(void *bp)
+{
+    return page_arena[((char *)bp - heap_lo) >> PAGE_SHIFT] & PAGE_BUDDY;
+}
+
+/*
+ * buddy_malloc: returns the payload of the smallest buddy block that holds
+ *               size bytes, splitting a larger block or a new zone.
+ *               Returns NULL if there is no free block and no zone can be
+ *               carved, and the caller falls back on a regular block.
+ */
+static void *buddy_malloc(arena_t *arena, size_t size)
+{
+    int order = BUDDY_MIN_ORDER, o;
+    block_t *block, *half;
+    size_t zone = 1UL << BUDDY_ZONE_ORDER;
+
+    while ((1UL << order) < size + dsize)
+        order++;
+
+    global_lock();
+    buddy_lock(arena);
+    o = __builtin_ffs(arena -> buddy_map & (~0U << order)) - 1;
+    if (o >= 0)
+    {
+        block = arena -> buddy[o];
+        buddy_unlink(arena, block, o);
+    }
+    else
+    {
+        // Carve a new zone out of the heap, aligned to its size; once the
+        // heap has failed to grow for one, zones come from free space only
+        block = carve_aligned(arena, zone, zone, !arena -> buddy_full);
+        if (block == NULL)
+        {
+            arena -> buddy_full = true;
+            buddy_unlock(arena);
+            global_unlock();
+            return NULL;
+        }
+        block = header_to_payload(block);
+        memset(&page_arena[((char *)block - heap_lo) >> PAGE_SHIFT],
+            arena -> id | PAGE_BUDDY, zone >> PAGE_SHIFT);
+        o = BUDDY_ZONE_ORDER;
+    }
+
+    // Split, keeping the lower half and freeing the upper one
+    while (o > order)
+    {
+        o--;
+        half = (block_t *)((char *)block + (1UL << o));
+        buddy_push(arena, half, o);
+    }
+    block -> header = order;
+    buddy_unlock(arena);
+    global_unlock();
+    return (char *)block + dsize;
+}
+
+/*
+ * buddy_free: frees a buddy block, merging it with its buddy as long as the
+ *             buddy is free and whole. A zone that becomes free is kept
+ *             for reuse if it is the arena's only one, else it goes back
+ *             to the heap. The caller holds the global lock under LOCK_GLOBAL.
+ */
+static void buddy_free(arena_t *arena, void *bp)
+{
+    block_t *block = (block_t *)((char *)bp - dsize);
+    block_t *buddy;
+    int order = block -> header & 0xff;
+
+    buddy_lock(arena);
+    while (order < BUDDY_ZONE_ORDER)
+    {
+        // Zones are aligned to absolute addresses, like every carve, so
+        // the buddy is too, whatever the alignment of heap_lo
+        buddy = (block_t *)((uintptr_t)block ^ (1UL << order));
+        if (buddy -> header != (word_t)(order | BUDDY_FREE))
+            break;
+        buddy_unlink(arena, buddy, order);
+        if (buddy < block)
+            block = buddy;
+        order++;
+    }
+    if (order == BUDDY_ZONE_ORDER && arena -> buddy[order] != NULL)
+    {
+        memset(&page_arena[((char *)block - heap_lo) >> PAGE_SHIFT],
+            arena -> id, 1UL << (BUDDY_ZONE_ORDER - PAGE_SHIFT));
+        buddy_unlock(arena);
+        free_block(payload_to_header(block));
+        return;
+    }
+    buddy_push(arena, block, order);
+    buddy_unlock(arena);
+}
+
+/*
+ * buddy_push: tags a block free and pushes it onto the list of its order.
+ */
+static void buddy_push(arena_t *arena, block_t *block, int order)
+{
+    block -> header = order | BUDDY_FREE;
+    link_push(&arena -> buddy[order], block);
+    arena -> buddy_map |= 1U << order;
+}
+
+/*
+ * buddy_unlink: removes a free block from the list of its order and clears
+ *               its free tag.
+ */
+static void buddy_unlink(arena_t *arena, block_t *block, int order)
+{
+    block -> header = order;
+    link_unlink(&arena -> buddy[order], block);
+    if (arena -> buddy[order] == NULL)
+        arena -> buddy_map &= ~(1U << order);
+}
+
+/*
+ * buddy_trim: returns the arena's idle zone to the heap.
+ *             Returns true if a zone was released.
+ */
+static bool buddy_trim(arena_t *arena)
+{
+    block_t *block;
+
+    if (arena -> buddy[BUDDY_ZONE_ORDER] == NULL)
+        return false;
+    buddy_lock(arena);
+    block = arena -> buddy[BUDDY_ZONE_ORDER];
+    if (block != NULL)
+    {
+        buddy_unlink(arena, block, BUDDY_ZONE_ORDER);
+        memset(&page_arena[((char *)block - heap_lo) >> PAGE_SHIFT],
+            arena -> id, 1UL << (BUDDY_ZONE_ORDER - PAGE_SHIFT));
+    }
+    buddy_unlock(arena);
+    if (block == NULL)
+        return false;
+    free_block(payload_to_header(block));
+    return true;
+}
+
+/*
+ * <what does extend_heap do?>
+ * Extends the arena's heap with the requested number of bytes, and recreates end header. 
+ * If the arena's newest segment no longer ends at the break, a new page-aligned
+ * segment with its own prologue footer is started instead.
+ * Returns a pointer to the result of merging the newly-created block with the top or previous free block, 
+ * if applicable, or NULL in failure. The returned block is not on any free list, nor the top.
+ */
+static inline  block_t *extend_heap(arena_t *arena, size_t size) 
+{
+    void *bp;
+    char *brk, *fresh;
+    word_t *start;
+    size_t pad;
+    block_t *block, *merged, *top;
+
+    // Allocate an even number of words to maintain alignment
+    size = round_up(size, dsize);
+
+    grow_lock(arena);
+#if LOCKING == LOCK_FINE
+    // memlib keeps a single break for all arenas
+    lock_acquire(&heap_lock);
+#endif
+    brk = (char *)mem_heap_hi() + 1;
+    fresh = mem_heap_fresh();
+    if (arena -> epilogue != NULL && (char *)(arena -> epilogue) + wsize == brk)
+    {
+        // The segment ends at the break: grow it in place, reusing the
+        // end header (and its ABIT) as the new block's header
+        bp = mem_sbrk(size);
+        block = payload_to_header(bp);
+    }
+    else
+    {
+        // Another arena owns the break: open a segment on a fresh page
+        pad = round_up((size_t)(brk - heap_lo), 1 << PAGE_SHIFT) - (size_t)(brk - heap_lo);
+        start = mem_sbrk(pad + size + dsize);
+        bp = start;
+        if (start != (void *)-1)
+        {
+            start = (word_t *)((char *)start + pad);
+            start[0] = pack(0, true); // Prologue footer
+            bp = &start[2];
+            block = payload_to_header(bp);
+            block -> header = ABIT;
+        }
+    }
+    if (bp == (void *)-1)
+    {
+#if LOCKING == LOCK_FINE
+        lock_release(&heap_lock);
+#endif
+        grow_unlock(arena);
+        return NULL;
+    }
+    stat_add(&stats.extend_calls, 1);
+    stat_add(&stats.extend_bytes, size);
+    // In place, the page holding the old end header is mapped already
+    arena_map(arena, (char *)bp - dsize, (char *)bp + size);
+    // Only space memlib has never handed out is fresh: a new segment
+    // starts fresh from its first block, an old one grows fresh as it was
+    if ((char *)block > (char *)arena -> epilogue)
+        fresh_raise(arena, (fresh > (char *)block) ? fresh : (char *)block);
+    else if (fresh > (char *)bp)
+        fresh_raise(arena, fresh);
+#if LOCKING == LOCK_FINE
+    lock_release(&heap_lock);
+#endif
+    
+    // Initialize free block header/footer 
+    write_header(block, size, false);
+    write_footer(block, size, false);
+    
+    // Create new end header
+    block_t *block_next = find_next(block);
+    block_next -> header = pack(0, true);
+    arena -> epilogue = block_next;
+    // The caller takes over the top
+    top = arena -> top;
+    arena -> top = NULL;
+    grow_unlock(arena);
+
+    if (top != NULL && find_next(top) == block)
+    {
+        // Grown in place: the new space joins the top
+        size += get_size(top);
+        block -> header = 0;
+        write_header(top, size, false);
+        write_footer(top, size, false);
+        check_merged(top);
+        merged = top;
+    }
+    else
+    {
+        // A top left behind in an older segment is a free block like any
+        if (top != NULL)
+            list_put(arena, top);
+        merged = merge(arena, block);
+    }
+    // Clear the footer before the new space, which may lie in fresh space
+    if (merged != block)
+        *find_prev_footer(block) = 0;
+    return merged;
+}
+
+/*
+ * grow_size: returns how many bytes to extend the arena's heap by for a
+ *            request of size bytes. Allocation pressure is high when less
+ *            than half of the last step came back through free before the
+ *            next extension; while it stays high, twice in a row, the step
+ *            doubles, and otherwise it falls back to chunksize. The step
+ *            never exceeds grow_overshoot percent of the heap, which bounds
+ *            what an extension can leave unused at the peak.
+ */
+static size_t grow_size(arena_t *arena, size_t size)
+{
+    size_t step = chunksize, last, cap;
+    bool hot, was_hot;
+
+    // Under LOCK_FINE these are hints, read and set without a lock
+    last = __atomic_load_n(&arena -> grow_step, __ATOMIC_RELAXED);
+    hot = __atomic_load_n(&arena -> grow_freed, __ATOMIC_RELAXED) < last / 2;
+    was_hot = __atomic_exchange_n(&arena -> grow_hot, hot, __ATOMIC_RELAXED);
+    if (grow_overshoot != 0 && hot && was_hot)
+    {
+        cap = max(round_up(mem_heapsize() / 100 * grow_overshoot, chunksize), chunksize);
+        step = (2 * last < cap) ? 2 * last : cap;
+    }
+    __atomic_store_n(&arena -> grow_step, step, __ATOMIC_RELAXED);
+    __atomic_store_n(&arena -> grow_freed, 0, __ATOMIC_RELAXED);
+    return max(size, step);
+}
+
+/*
+ * grow_note_free: counts size bytes freed in the arena for grow_size.
+ */
+static void grow_note_free(arena_t *arena, size_t size)
+{
+#if LOCKING == LOCK_NONE
+    arena -> grow_freed += size;
+#else
+    __atomic_fetch_add(&arena -> grow_freed, size, __ATOMIC_RELAXED);
+#endif
 }
 
-/******** The remaining content below are helper and debug routines ********/
+/*
+ * mm_set_option: sets a run-time allocator option by name:
+ *                "slab" 0/1 serves requests of up to SLAB_MAX bytes from slab runs.
+ *                "engine" ENGINE_SEGLIST/ENGINE_TLSF, from the next mm_init on.
+ *                "buddy" n serves requests of n bytes and more (up to a zone)
+ *                from buddy zones, 0 turns them off.
+ *                "remap" n page-aligns payloads that realloc moves to n bytes
+ *                and more, so that their later moves remap pages, 0 turns it
+ *                off.
+ *                "mmap" n gives requests of n bytes and more a mapping of
+ *                their own outside the heap, 0 turns it off.
+ *                "check" n has each mm_checkheap call examine n heap blocks
+ *                and n free list entries, 0 turns the checks off.
+ *                "grow" n lets a heap extension overshoot the request by up
+ *                to n percent of the heap under allocation pressure, 0 grows
+ *                by chunksize steps.
+ *                "order" ORDER_LIFO/ORDER_FIFO/ORDER_ADDR orders every class
+ *                list below TREE_CLASS, "order<i>" class i alone, from the
+ *                next mm_init on.
+ *                Returns false for an unknown option or value.
+ */
+bool mm_set_option(const char *name, long value)
+{
+    char *end;
+    long sIndex;
+
+    if (strcmp(name, "slab") == 0 && (value == 0 || value == 1))
+    {
+        slab_enabled = value;
+        return true;
+    }
+    if (strcmp(name, "engine") == 0 && (value == ENGINE_SEGLIST || value == ENGINE_TLSF))
+    {
+        engine_next = value;
+        return true;
+    }
+    if (strcmp(name, "buddy") == 0 && value >= 0)
+    {
+        buddy_min = value;
+        return true;
+    }
+    if (strcmp(name, "remap") == 0 && value >= 0)
+    {
+        remap_min = value;
+        return true;
+    }
+    if (strcmp(name, "mmap") == 0 && value >= 0)
+    {
+        mmap_min = value;
+        return true;
+    }
+    if (strcmp(name, "check") == 0 && value >= 0)
+    {
+        check_budget = value;
+        return true;
+    }
+    if (strcmp(name, "grow") == 0 && value >= 0)
+    {
+        grow_overshoot = value;
+        return true;
+    }
+    if (strncmp(name, "order", 5) == 0 && value >= ORDER_LIFO && value <= ORDER_ADDR)
+    {
+        if (name[5] == '\0')
+        {
+            memset(order_next, value, sizeof(order_next));
+            return true;
+        }
+        sIndex = strtol(name + 5, &end, 10);
+        if (*end == '\0' && sIndex >= 0 && sIndex < TREE_CLASS)
+        {
+            order_next[sIndex] = value;
+            return true;
+        }
+    }
+    return false;
+}
 
 /*
- * <what does extend_heap do?>
- * Extends the heap with the requested number of bytes, and recreates end header. 
- * Returns a pointer to the result of coalescing the newly-created block with previous free block, 
- * if applicable, or NULL in failure.
+ * mm_lock_report: prints, for every lock taken since mm_init, how often it
+ *                 was acquired, how often it had to wait and for how long.
+ *                 Meant to be called while no other thread is allocating.
  */
-static inline  block_t *extend_heap(size_t size) 
+void mm_lock_report(FILE *out)
 {
-    void *bp;
+    int a, i;
+    lock_t *lock;
+
+    fprintf(out, "%-8s %-8s %12s %12s %12s\n", "arena", "lock", "acquired", "contended", "wait(us)");
+    if (heap_lock.acquired != 0)
+    {
+        fprintf(out, "%-8s %-8s %12lu %12lu %12lu\n", "-", (LOCKING == LOCK_GLOBAL) ? "heap" : "brk",
+            heap_lock.acquired, heap_lock.contended, heap_lock.wait_ns / 1000);
+    }
+    for (a = 0; a < ARENAS; a++)
+    {
+        for (i = 0; i < LOCKS; i++)
+        {
+            lock = &arenas[a].locks[i];
+            if (lock -> acquired == 0)
+                continue;
+            if (i == 0)
+                fprintf(out, "%-8d %-8s", a, "mini");
+            else if (i == GROW_LOCK)
+                fprintf(out, "%-8d %-8s", a, "grow");
+            else if (i == BUDDY_LOCK)
+                fprintf(out, "%-8d %-8s", a, "buddy");
+            else if (i == FAST_LOCK)
+                fprintf(out, "%-8d %-8s", a, "fast");
+            else if (i > GROW_LOCK)
+                fprintf(out, "%-8d slab%-4d", a, (i - GROW_LOCK) * 16);
+            else
+                fprintf(out, "%-8d class%-3d", a, i - 1);
+            fprintf(out, " %12lu %12lu %12lu\n", lock -> acquired, lock -> contended, lock -> wait_ns / 1000);
+        }
+        lock = &arenas[a].remote_lock;
+        if (lock -> acquired != 0 || lock -> contended != 0)
+        {
+            fprintf(out, "%-8d %-8s %12lu %12lu %12s\n", a, "remote",
+                lock -> acquired, lock -> contended, "-");
+        }
+    }
+}
 
-    void *e = mem_heap_hi();
-    e = (((char *)e) - 7); 
-    long EHeaderBit = (ABIT) & (*((long *)e));
-    long EHeaders = (SBIT) & (*((long *)e));
+/*
+ * mm_get_stats: copies the event counters into *out and adds a snapshot of
+ *               the heap: the free blocks of each class, counting the tops
+ *               of the arenas with their lists, and how its bytes
+ *               split between payload, metadata and idle space. Blocks in
+ *               the tcaches of other threads count as payload. Meant to be
+ *               called while no other thread is allocating. Returns false
+ *               if the counters were not built in (STATS).
+ */
+bool mm_get_stats(mm_stats_t *out)
+{
+    arena_t *arena;
+    block_t *block;
+    size_t walked = 0, cached = 0;
+    int a, i;
 
-    // Allocate an even number of words to maintain alignment
-    size = round_up(size, dsize);
-    if ((bp = mem_sbrk(size)) == (void *)-1)
+    global_lock();
+    *out = stats;
+    if (heap_start != NULL)
     {
-        return NULL;
+        for (a = 0; a < ARENAS; a++)
+        {
+            arena = &arenas[a];
+            stats_list(out, arena -> smallListHeader);
+            if (engine == ENGINE_TLSF)
+            {
+                for (i = 0; i < TLSF_FL * TLSF_SL; i++)
+                    stats_list(out, arena -> tlsf[i / TLSF_SL][i % TLSF_SL]);
+            }
+            else
+            {
+                for (i = 0; i < TREE_CLASS; i++)
+                    stats_list(out, arena -> listHeader[i]);
+                stats_treap(out, arena -> listHeader[TREE_CLASS]);
+            }
+            // The top is free, but on no list
+            if (arena -> top != NULL)
+            {
+                i = getList(get_size(arena -> top)) + 1;
+                out -> free_blocks[i]++;
+                out -> free_bytes[i] += get_size(arena -> top);
+            }
+            // Fastbin blocks look allocated, but hold no payload
+            for (i = 0; i < FAST_BINS; i++)
+            {
+                for (block = arena -> fast[i]; block != NULL; block = NEXTBLOCK)
+                    cached += get_size(block) - wsize;
+            }
+        }
+        if (tcache.gen == heap_gen)
+        {
+            for (i = 0; i < TCACHE_BINS; i++)
+            {
+                for (block = tcache.bin[i]; block != NULL; block = NEXTBLOCK)
+                    cached += get_size(block) - wsize;
+            }
+        }
+
+        block = heap_start;
+        while (block != NULL)
+        {
+            if (get_size(block) == 0)
+            {
+                block = next_segment(block);
+                continue;
+            }
+            walked += get_size(block);
+            if (get_alloc(block))
+                stats_block(out, block);
+            block = find_next(block);
+        }
+        out -> heap_bytes = mem_heapsize();
+        // Prologue footers, end headers and the padding between segments
+        out -> metadata_bytes += out -> heap_bytes - walked;
+        out -> payload_bytes -= cached;
+        out -> idle_bytes += cached;
     }
-    
-    // Initialize free block header/footer 
-    block_t *block = payload_to_header(bp);
-    write_header(block, size, false);
-    write_footer(block, size, false);
+    for (i = 0; i < MAP_SLOTS; i++)
+    {
+        if (mappings[i].start != NULL)
+            out -> mapped_bytes += mappings[i].size;
+    }
+    global_unlock();
+    return STATS != 0;
+}
 
-    // Carry over end ABIT and SBIT
-    block->header |= (EHeaderBit) | (EHeaders);
-    
-    // Create new end header
-    block_t *block_next = find_next(block);
-    block_next -> header = 0;
-    write_header(block_next, 0, true);
+/*
+ * stat_add: adds n to an event counter of mm_get_stats; nothing unless
+ *           the counters are built in.
+ */
+static void stat_add(unsigned long *counter, unsigned long n)
+{
+#if STATS
+#if LOCKING == LOCK_NONE
+    *counter += n;
+#else
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+#endif
+#else
+    (void)counter;
+    (void)n;
+#endif
+}
+
+/*
+ * stats_list: counts the blocks of a doubly linked free list by class.
+ */
+static void stats_list(mm_stats_t *out, block_t *block)
+{
+    int c;
+
+    for (; block != NULL; block = link_next(block))
+    {
+        c = getList(get_size(block)) + 1;
+        out -> free_blocks[c]++;
+        out -> free_bytes[c] += get_size(block);
+    }
+}
+
+/*
+ * stats_treap: counts the blocks of a treap, all of TREE_CLASS.
+ */
+static void stats_treap(mm_stats_t *out, block_t *node)
+{
+    for (; node != NULL; node = node -> payload.tree.right)
+    {
+        stats_treap(out, node -> payload.tree.left);
+        out -> free_blocks[TREE_CLASS + 1]++;
+        out -> free_bytes[TREE_CLASS + 1] += get_size(node);
+    }
+}
+
+/*
+ * stats_block: splits an allocated heap block into payload, metadata and
+ *              idle bytes. A slab run counts its objects in use as payload
+ *              and its free slots as idle; a buddy zone is walked block by
+ *              block, each one a tag and a payload, or idle.
+ */
+static void stats_block(mm_stats_t *out, block_t *block)
+{
+    char *bp = header_to_payload(block), *p, *end;
+    size_t size = get_size(block), used;
+    slab_t *run;
+    word_t tag;
+
+    if (is_slab(bp))
+    {
+        run = (slab_t *)bp;
+        used = (size_t)(run -> nslots - run -> nfree) * run -> osize;
+        out -> payload_bytes += used;
+        out -> idle_bytes += (size_t)run -> nfree * run -> osize;
+        out -> metadata_bytes += size - used - (size_t)run -> nfree * run -> osize;
+    }
+    else if (is_buddy(bp))
+    {
+        end = bp + (1UL << BUDDY_ZONE_ORDER);
+        out -> metadata_bytes += size - (1UL << BUDDY_ZONE_ORDER);
+        for (p = bp; p < end; p += 1UL << (tag & 0xff))
+        {
+            tag = *(word_t *)p;
+            if (tag & BUDDY_FREE)
+                out -> idle_bytes += 1UL << (tag & 0xff);
+            else
+            {
+                out -> metadata_bytes += dsize;
+                out -> payload_bytes += (1UL << (tag & 0xff)) - dsize;
+            }
+        }
+    }
+    else
+    {
+        out -> metadata_bytes += wsize;
+        out -> payload_bytes += size - wsize;
+    }
+}
+
+/*
+ * lock_acquire: takes the lock, leaving the waiting to lock_wait.
+ */
+static inline void lock_acquire(lock_t *lock)
+{
+    if (__atomic_exchange_n(&lock -> held, 1, __ATOMIC_ACQUIRE))
+        lock_wait(lock);
+    lock -> acquired++;
+}
+
+/*
+ * lock_try: takes the lock only if it is free. A failed attempt counts as
+ *           contention, without wait time. Returns true if taken.
+ */
+static inline bool lock_try(lock_t *lock)
+{
+    if (__atomic_exchange_n(&lock -> held, 1, __ATOMIC_ACQUIRE))
+    {
+        __atomic_add_fetch(&lock -> contended, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    lock -> acquired++;
+    return true;
+}
+
+/*
+ * lock_wait: spins until a contended lock is taken, yielding the CPU every
+ *            LOCK_SPINS rounds, and accounts the time spent waiting.
+ */
+static void lock_wait(lock_t *lock)
+{
+    struct timespec t0, t1;
+    int spins = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    do
+    {
+        while (__atomic_load_n(&lock -> held, __ATOMIC_RELAXED))
+        {
+            if (++spins % LOCK_SPINS == 0)
+                sched_yield();
+        }
+    } while (__atomic_exchange_n(&lock -> held, 1, __ATOMIC_ACQUIRE));
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    lock -> contended++;
+    lock -> wait_ns += (t1.tv_sec - t0.tv_sec) * 1000000000L + (t1.tv_nsec - t0.tv_nsec);
+}
+/*
+ * lock_release: releases a lock taken by lock_acquire.
+ */
+static inline void lock_release(lock_t *lock)
+{
+    __atomic_store_n(&lock -> held, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * global_lock, global_unlock: bracket every shared-heap operation under
+ *                             LOCK_GLOBAL; no-ops in the other modes.
+ */
+static void global_lock(void)
+{
+#if LOCKING == LOCK_GLOBAL
+    lock_acquire(&heap_lock);
+#endif
+}
+
+static void global_unlock(void)
+{
+#if LOCKING == LOCK_GLOBAL
+    lock_release(&heap_lock);
+#endif
+}
+
+/*
+ * memlib_lock, memlib_unlock: guard calls into memlib made outside
+ *                             extend_heap; memlib keeps one break, page
+ *                             table and mapping list for all threads.
+ */
+static void memlib_lock(void)
+{
+#if LOCKING != LOCK_NONE
+    lock_acquire(&heap_lock);
+#endif
+}
+
+static void memlib_unlock(void)
+{
+#if LOCKING != LOCK_NONE
+    lock_release(&heap_lock);
+#endif
+}
+
+/*
+ * class_lock, class_unlock: guard one free list under LOCK_FINE.
+ *                           sIndex -1 is the mini block list.
+ */
+static void class_lock(arena_t *arena, int sIndex)
+{
+#if LOCKING == LOCK_FINE
+    lock_acquire(&arena -> locks[sIndex + 1]);
+#endif
+}
+
+static void class_unlock(arena_t *arena, int sIndex)
+{
+#if LOCKING == LOCK_FINE
+    lock_release(&arena -> locks[sIndex + 1]);
+#endif
+}
+
+/*
+ * class_lock_pair: takes the locks of up to two classes, lower index first,
+ *                  so that concurrent coalesces cannot deadlock.
+ *                  An index of -2 stands for "no class".
+ */
+static void class_lock_pair(arena_t *arena, int a, int b)
+{
+    if (a > b)
+    {
+        int t = a;
+        a = b;
+        b = t;
+    }
+    if (a != -2)
+        class_lock(arena, a);
+    if (b != -2 && b != a)
+        class_lock(arena, b);
+}
+
+static void class_unlock_pair(arena_t *arena, int a, int b)
+{
+    if (a != -2)
+        class_unlock(arena, a);
+    if (b != -2 && b != a)
+        class_unlock(arena, b);
+}
+
+/*
+ * grow_lock, grow_unlock: serialize heap growth of one arena under LOCK_FINE.
+ */
+static void grow_lock(arena_t *arena)
+{
+#if LOCKING == LOCK_FINE
+    lock_acquire(&arena -> locks[GROW_LOCK]);
+#endif
+}
+
+static void grow_unlock(arena_t *arena)
+{
+#if LOCKING == LOCK_FINE
+    lock_release(&arena -> locks[GROW_LOCK]);
+#endif
+}
+
+/*
+ * slab_lock, slab_unlock: guard the runs of one slab class under LOCK_FINE.
+ */
+static void slab_lock(arena_t *arena, int cls)
+{
+#if LOCKING == LOCK_FINE
+    lock_acquire(&arena -> locks[GROW_LOCK + 1 + cls]);
+#endif
+}
+
+static void slab_unlock(arena_t *arena, int cls)
+{
+#if LOCKING == LOCK_FINE
+    lock_release(&arena -> locks[GROW_LOCK + 1 + cls]);
+#endif
+}
+
+/*
+ * buddy_lock, buddy_unlock: guard the arena's buddy lists under LOCK_FINE.
+ */
+static void buddy_lock(arena_t *arena)
+{
+#if LOCKING == LOCK_FINE
+    lock_acquire(&arena -> locks[BUDDY_LOCK]);
+#endif
+}
+
+static void buddy_unlock(arena_t *arena)
+{
+#if LOCKING == LOCK_FINE
+    lock_release(&arena -> locks[BUDDY_LOCK]);
+#endif
+}
 
-    // Coalesce in case the previous block was free
-    return coalesce(block);
+/*
+ * fast_lock, fast_unlock: guard the arena's fastbins under LOCK_FINE.
+ */
+static void fast_lock(arena_t *arena)
+{
+#if LOCKING == LOCK_FINE
+    lock_acquire(&arena -> locks[FAST_LOCK]);
+#endif
+}
+
+static void fast_unlock(arena_t *arena)
+{
+#if LOCKING == LOCK_FINE
+    lock_release(&arena -> locks[FAST_LOCK]);
+#endif
+}
+
+/*
+ * arena_get: returns the calling thread's arena, handing arenas out
+ *            round-robin the first time a thread allocates after mm_init.
+ */
+static arena_t *arena_get(void)
+{
+    if (thread_gen != heap_gen)
+    {
+        thread_arena = &arenas[__atomic_fetch_add(&arena_next, 1, __ATOMIC_RELAXED) % ARENAS];
+        thread_gen = heap_gen;
+    }
+    return thread_arena;
+}
+
+/*
+ * arena_of: returns the arena whose segment contains the block.
+ */
+static arena_t *arena_of(block_t *block)
+{
+    return &arenas[page_arena[((char *)block - heap_lo) >> PAGE_SHIFT] & PAGE_ARENA];
+}
+
+/*
+ * arena_map: records the arena as owner of every page starting in [lo, hi).
+ *            Pages that started earlier keep their owner and flags.
+ */
+static void arena_map(arena_t *arena, void *lo, void *hi)
+{
+    size_t first = ((char *)lo - heap_lo + (1 << PAGE_SHIFT) - 1) >> PAGE_SHIFT;
+    size_t last = ((char *)hi - 1 - heap_lo) >> PAGE_SHIFT;
+
+    dbg_requires(last < HEAP_PAGES);
+    memset(&page_arena[first], arena -> id, last - first + 1);
 }
 
 /* checkAlloc: Checks the ABIT of current block and returns true if the previous block is allocated, false otherwise.
@@ -605,160 +4047,341 @@ static bool checkAlloc(block_t *block)
 
 /*
  * <what does coalesce do?>
- * Coalesces current block with previous and next blocks if either or both are unallocated; otherwise the block is not modified.
- * Returns pointer to the coalesced block. After coalescing, the immediate contiguous previous and next blocks must be allocated.
+ * Coalesces current block with previous and next blocks if either or both are unallocated,
+ * then inserts the result into the free lists.
+ * Returns pointer to the coalesced block.
  */
-static inline block_t *coalesce(block_t * block) 
+static inline block_t *coalesce(arena_t *arena, block_t * block) 
 {
+    block = merge(arena, block);
+    list_put(arena, block);
+    return block;
+}
 
+/*
+ * merge: Merges a free block that is on no list with its previous and next
+ * blocks if they are free. Returns the merged block, which is also on no list.
+ * A neighbour is only taken over while it sits on a free list (LBIT set).
+ * Under LOCK_FINE both neighbours' class locks are taken in ascending order
+ * and their headers re-checked, so a neighbour that another thread is
+ * working on is simply left alone.
+ */
+static block_t *merge(arena_t *arena, block_t *block)
+{
     size_t size = get_size(block);
     block_t *block_next;
-    block_t *block_prev, *temp; 
+    block_t *block_prev = NULL;
+    word_t header = header_load(block);
+    word_t next_header, prev_header = 0;
+    size_t prev_size = 0;
+    int pIndex = -2, nIndex = -2;
     block_next = find_next(block);
 
-    // Check if previous block is a small block, assign block_prev accordingly
-    if(block -> header & SBIT)
+    // Find the previous block by its footer, if it is free
+    if (!(header & ABIT))
+    {
+        prev_size = footer_size(*find_prev_footer(block));
+        // The footer is only trusted while its header agrees; a racing
+        // allocation may have reused it as payload, so bound it first
+        if (prev_size >= dsize && prev_size <= (size_t)((char *)block - heap_lo))
+        {
+            block_prev = (block_t *)((char *)block - prev_size);
+            prev_header = header_load(block_prev);
+            if (is_listed(prev_header) && extract_size(prev_header) == prev_size)
+                pIndex = list_class(prev_size);
+        }
+    }
+    next_header = header_load(block_next);
+    if (is_listed(next_header))
+        nIndex = list_class(extract_size(next_header));
+
+    class_lock_pair(arena, pIndex, nIndex);
+    // Take the neighbours off their lists if they are still there
+    bool prev_alloc = true;
+    bool next_alloc = true;
+    if (pIndex != -2 && !(header_load(block) & ABIT)
+        && ((header_load(block_prev) ^ prev_header) & ~(word_t)ABIT) == 0)
     {
-        block_prev = (block_t *)(((char *)block) - dsize);
+        listDelete(arena, block_prev);
+        prev_alloc = false;
     }
-    else
-    block_prev = find_prev(block);
-    bool prev_alloc = checkAlloc(block);
-    bool next_alloc = get_alloc(block_next);
+    if (nIndex != -2 && ((header_load(block_next) ^ next_header) & ~(word_t)ABIT) == 0)
+    {
+        listDelete(arena, block_next);
+        next_alloc = false;
+    }
+    class_unlock_pair(arena, pIndex, nIndex);
 
     if (prev_alloc && next_alloc)              // Case 1
     {
-       
-        listInsert(block,size);
-  
+        stat_add(&stats.coalesce[0], 1);
         return block;
     }
 
     else if (prev_alloc && !next_alloc)        // Case 2
     {
+        stat_add(&stats.coalesce[1], 1);
 
         size += get_size(block_next); 
-        listDelete(block_next);
 
-        // If next block is small, reset SBIT of the block further next
-        if(get_size(block_next) <= dsize)
-        {
-            temp = find_next(block_next);
-            temp->header = temp -> header & (~SBIT);
-        }
         block_next -> header = 0;
 
-        // Set the ABIT since the previous block after coalescing has to be allocated
-        write_header(block, size+ABIT, false);
-        write_footer(block, size+ABIT, false);
-        listInsert(block,size);
+        write_header(block, size, false);
+        write_footer(block, size, false);
+        check_merged(block);
 
         return block;
     }
 
     else if (!prev_alloc && next_alloc)        // Case 3
     {
+        stat_add(&stats.coalesce[2], 1);
      
-        size += get_size(block_prev);
-        listDelete(block_prev);
+        size += prev_size;
 
-        // Set the ABIT since the previous block after coalescing
-        // has to be allocated.
-        write_header(block_prev, size+ABIT, false);
-        write_footer(block_prev, size+ABIT, false);
+        write_header(block_prev, size, false);
+        write_footer(block_prev, size, false);
 
-        // If this block is small, reset SBIT of the next block
-        if(get_size(block)<=dsize)
-        {
-            temp = block_next;
-            temp->header = temp -> header & (~SBIT);
-        }
         block->header = 0;
-        block = block_prev;
-        listInsert(block,size);
-    
-        return block;
+        check_merged(block_prev);
+        return block_prev;
     }
 
     else                                       // Case 4
     {
+        stat_add(&stats.coalesce[3], 1);
       
-        size += get_size(block_next) + get_size(block_prev);
-        listDelete(block_prev);
-        listDelete(block_next);
+        size += get_size(block_next) + prev_size;
 
-        // If next block is small, reset SBIT of the block further next
-        if(get_size(block_next) <= dsize)
-        {
-            temp = find_next(block_next);
-            temp->header = temp -> header & (~SBIT);
-        }
         block_next->header = 0;
 
-        // Set the ABIT since the previous block after coalescing has to be allocated
-        write_header(block_prev, size+ABIT, false);
-        write_footer(block_prev, size+ABIT, false);
+        write_header(block_prev, size, false);
+        write_footer(block_prev, size, false);
         block->header = 0;
-        block = block_prev;
-        listInsert(block,size);
+        check_merged(block_prev);
+        return block_prev;
+    }
+}
 
-        return block;
+/*
+ * list_put: inserts a free block into its arena's free list, unless it
+ *           ends the arena's newest segment or the top follows it: then
+ *           it becomes the top.
+ */
+static void list_put(arena_t *arena, block_t *block)
+{
+    size_t size;
+    int sIndex;
+
+    if (top_join(arena, block))
+        return;
+    size = get_size(block);
+    sIndex = list_class(size);
+    class_lock(arena, sIndex);
+    listInsert(arena, block, size);
+    class_unlock(arena, sIndex);
+}
+
+/*
+ * top_join: makes a free block that is on no list the arena's top if it
+ *           ends the newest segment, or merges the top into it if the top
+ *           follows it. Returns false, changing nothing, otherwise.
+ */
+static bool top_join(arena_t *arena, block_t *block)
+{
+    block_t *next = find_next(block), *top;
+    size_t size;
+
+    // Most blocks are nowhere near the top: tell without the lock
+    if (next != arena -> top && next != arena -> epilogue)
+        return false;
+    grow_lock(arena);
+    top = arena -> top;
+    if (top != NULL && next == top)
+    {
+        size = get_size(block) + get_size(top);
+        top -> header = 0;
+        write_header(block, size, false);
+        write_footer(block, size, false);
+        check_merged(block);
     }
+    else if (top != NULL || next != arena -> epilogue)
+    {
+        grow_unlock(arena);
+        return false;
+    }
+    arena -> top = block;
+    grow_unlock(arena);
+    return true;
+}
+
+/*
+ * top_take: cuts a free block off the front of the arena's top with room
+ *           for asize bytes from its first align boundary on (0 for no
+ *           boundary). It is a pointer bump: no free list is touched.
+ *           Returns NULL, leaving the top alone, if it is too small.
+ */
+static block_t *top_take(arena_t *arena, size_t asize, size_t align)
+{
+    block_t *top, *block = NULL;
+
+    if (arena -> top == NULL)
+        return NULL;
+    grow_lock(arena);
+    top = arena -> top;
+    if (top != NULL)
+    {
+        if (align != 0)
+            asize += aligned_lead(top, align);
+        if (get_size(top) >= asize)
+            block = top_cut(arena, asize);
+    }
+    grow_unlock(arena);
     return block;
 }
 
+/*
+ * top_cut: cuts the first size bytes off the arena's top, which has at
+ *          least that many, and returns them as a free block on no list
+ *          that the caller allocates. The caller holds the growth lock.
+ */
+static block_t *top_cut(arena_t *arena, size_t size)
+{
+    block_t *top = arena -> top, *rest;
+    size_t tsize = get_size(top);
+
+    if (tsize == size)
+    {
+        arena -> top = NULL;
+        return top;
+    }
+    // The rest keeps its footer; its ABIT says what the cut block will be
+    rest = (block_t *)((char *)top + size);
+    rest -> header = ABIT;
+    write_header(top, size, false);
+    write_header(rest, tsize - size, false);
+    write_footer(rest, tsize - size, false);
+    arena -> top = rest;
+    return top;
+}
+
+/*
+ * top_absorb: grows an allocated block that the arena's top follows to
+ *             asize bytes with the front of the top.
+ *             Returns false if the top does not follow it or is too small.
+ */
+static bool top_absorb(arena_t *arena, block_t *block, size_t asize)
+{
+    block_t *next = find_next(block), *cut = NULL;
+
+    if (next != arena -> top)
+        return false;
+    grow_lock(arena);
+    if (next == arena -> top && get_size(block) + get_size(next) >= asize)
+        cut = top_cut(arena, asize - get_size(block));
+    grow_unlock(arena);
+    if (cut == NULL)
+        return false;
+    absorb_next(arena, block, false);
+    return true;
+}
 /*
  * <what does place do?>
  * Places block with size of asize at the start of bp.
  * If the remaining size is at least the minimum block size, then split the block to the the allocated block and the remaining block as free, which is then inserted into the segregated list. 
- * Requires that the block is initially unallocated.
+ * Requires that the block is unallocated and has been taken off its free list.
+ * Returns the first payload byte from which the block had never been handed out, so reads as
+ * zero apart from its last word, or the end of the block if there is none.
  */
-static void place(block_t *block, size_t asize)
+static char *place(arena_t *arena, block_t *block, size_t asize)
 {
     size_t csize = get_size(block);
-
-    // Extract ABIT and SBIT in current block
-    int abit = (block -> header) & (ABIT);
-    int sbit = (block -> header) & (SBIT);
+    char *end, *zero;
    
     block_t *block_next;
-    listDelete(block);
-    if ((csize - asize) >= min_block_size/2)
+    if ((csize - asize) >= min_block_size)
     {
-        // Carry over SBIT and ABIT to the allocated block
-        write_header(block, asize+abit+sbit, true);
+        stat_add(&stats.place_split, 1);
+        write_header(block, asize, true);
         block_next = find_next(block);
         block_next -> header = 0;
-        // Set SBIT if a small block is allocated
-        if(asize==dsize)
-            sbit = SBIT;
-        else
-            sbit = 0;
-        // Set ABIT, set/reset SBIT accordingly in the new free block
-        write_header(block_next, csize-asize+ABIT+sbit, false);
+        // Set ABIT in the new free block
+        write_header(block_next, csize-asize, false);
+        header_set(block_next, ABIT);
         write_footer(block_next, csize-asize, false);
-        coalesce(block_next);
+        coalesce(arena, block_next);
     }
 
     else
     { 
-        write_header(block, csize+abit, true);
-
-        // If small block is allocated, set SBIT in next block 
-        if(csize == dsize)
-        {
-            block_next = find_next(block);
-            block_next -> header = (block_next -> header) | (SBIT);
-        }
+        stat_add(&stats.place_whole, 1);
+        // Sets the ABIT in the next block
+        write_header(block, csize, true);
     }
-   
+
+    // Fresh space starts past the header and links left at the old mark
+    end = (char *)find_next(block);
+    zero = fresh_raise(arena, end) + 3 * wsize;
+    if (zero < (char *)header_to_payload(block))
+        zero = header_to_payload(block);
+    return (zero < end) ? zero : end;
 }
 
+/*
+ * fresh_raise: moves the arena's fresh mark up to the given address, if
+ *              it is below. Returns the mark as it was.
+ */
+static char *fresh_raise(arena_t *arena, char *to)
+{
+#if LOCKING == LOCK_FINE
+    // place runs outside the class locks
+    char *old = __atomic_load_n(&arena -> fresh, __ATOMIC_RELAXED);
+
+    while (old < to && !__atomic_compare_exchange_n(&arena -> fresh, &old, to, true,
+                                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        ;
+    return old;
+#else
+    char *old = arena -> fresh;
+
+    if (old < to)
+        arena -> fresh = to;
+    return old;
+#endif
+}
 /*
  * <what does find_fit do?>
- * Looks for a free block with at least asize bytes with first-fit policy. Returns NULL if none is found.
+ * Looks for a free block with at least asize bytes: a perfect fit from the exact-size index,
+ * else the best fit among the packed sizes of the first PACK_SLOTS blocks of a class, else
+ * the best of at most THRESHFIT loose candidates. Every block of a later class is larger
+ * than any block of an earlier one, so the search stops at the first class that yields a
+ * candidate.
+ * The chosen block is taken off its list before its class lock is released.
+ * Returns NULL if none is found.
+ */
+static inline block_t *find_fit(arena_t *arena, size_t asize)
+{
+    block_t *block;
+    unsigned long visited = 0;
+    int c = getList(asize) + 1;
+
+    if (engine == ENGINE_TLSF)
+    {
+        block = tlsf_find_fit(arena, asize);
+        visited = (block != NULL);
+    }
+    else
+        block = seglist_find_fit(arena, asize, &visited);
+    stat_add(block != NULL ? &stats.fit_hits[c] : &stats.fit_misses[c], 1);
+    stat_add(&stats.fit_visited[c], visited);
+    return block;
+}
+
+/*
+ * seglist_find_fit: ENGINE_SEGLIST search of find_fit; adds the number of
+ *                   free blocks it looked at to *visited.
  */
-static inline block_t *find_fit(size_t asize)
+static block_t *seglist_find_fit(arena_t *arena, size_t asize, unsigned long *visited)
 {
     block_t *block, *bestblk = NULL;
     int sIndex = getList(asize), i, t=0;
@@ -767,15 +4390,15 @@ static inline block_t *find_fit(size_t asize)
     // If size<=16, search in small blocks list
     if( sIndex==-1)
     {
-        block = smallListHeader;
-        while(block!=NULL)
-        {   
-            tsize = get_size(block);
-            if(asize <= tsize)
-            {
-                return block;
-            }
-            block = NEXTBLOCK;
+        class_lock(arena, -1);
+        block = arena -> smallListHeader;
+        if (block != NULL)
+            listDelete(arena, block);
+        class_unlock(arena, -1);
+        if (block != NULL)
+        {
+            (*visited)++;
+            return block;
         }
         sIndex = 0;
     }
@@ -784,16 +4407,43 @@ static inline block_t *find_fit(size_t asize)
     // continue over to next class if no block is found in that class.
     for (i=sIndex; i<LISTSIZE; i++)    
     {
-        block = listHeader[i];
+        if (arena -> listHeader[i] == NULL)
+            continue;
+        class_lock(arena, i);
+        if (i == TREE_CLASS)
+        {
+            bestblk = treap_fit(arena -> listHeader[i], asize);
+            if (bestblk != NULL)
+                listDelete(arena, bestblk);
+            class_unlock(arena, i);
+            (*visited)++;
+            return bestblk;
+        }
+        // A block of exactly asize bytes comes from the exact-size index,
+        // with no walk; else the packed sizes of the first blocks are
+        // scanned, and only loose blocks are visited if none of them fits
+        block = NULL;
+        if (i == sIndex && asize > dsize && order[i] == ORDER_LIFO)
+            bestblk = exact_find(arena, i, asize);
+        if (bestblk == NULL)
+            bestblk = pack_fit(arena, i, asize);
+        if (bestblk != NULL)
+            (*visited)++;
+        else
+            block = pack_rest(arena, i);
         while (block!=NULL)
         {   
+            (*visited)++;
             tsize = get_size(block);
             if (asize<tsize)
             {   
                 // THRESHFIT limits the number of blocks to check
                 // before deciding the best fit free block.
                 if (t ++== THRESHFIT)
-                return bestblk;
+                {
+                    stat_add(&stats.fit_cutoffs, 1);
+                    break;
+                }
                 if ((tsize-asize) < (bsize-asize))
                 {
                     bsize = tsize;
@@ -801,28 +4451,489 @@ static inline block_t *find_fit(size_t asize)
                 }
             }
 
-            // If sizes match perfectly, return the block immediately
+            // If sizes match perfectly, take the block immediately
             else if (asize == tsize)
             {
-                return block;
+                bestblk = block;
+                break;
             }
-            block = NEXTBLOCK;
+            block = link_next(block);
         }
+        if (bestblk != NULL)
+            listDelete(arena, bestblk);
+        class_unlock(arena, i);
+        if (bestblk != NULL || t > THRESHFIT)
+            return bestblk;
     }
    return bestblk;
 }
 
-/* 
+/*
+ * tlsf_find_fit: ENGINE_TLSF counterpart of find_fit: takes a mini block for a
+ *                16-byte request if there is one, else the head of the first
+ *                TLSF list that is guaranteed to fit. Returns NULL if none.
+ */
+static block_t *tlsf_find_fit(arena_t *arena, size_t asize)
+{
+    block_t *block = NULL;
+
+    if (asize == dsize)
+    {
+        class_lock(arena, -1);
+        block = arena -> smallListHeader;
+        if (block != NULL)
+            listDelete(arena, block);
+        class_unlock(arena, -1);
+        if (block != NULL)
+            return block;
+    }
+
+    class_lock(arena, 0);
+    block = tlsf_search(arena, asize);
+    if (block != NULL)
+        listDelete(arena, block);
+    class_unlock(arena, 0);
+    return block;
+}
+
+/*
+ * take_exact: takes a free block of exactly asize bytes off the arena's
+ *             lists, from the exact-size index or else looking at no more
+ *             than THRESHFIT blocks of its class.
+ *             Returns NULL if none is found.
+ */
+static block_t *take_exact(arena_t *arena, size_t asize)
+{
+    int sIndex = list_class(asize), t = 0, fl, sl;
+    block_t *block, *indexed = NULL;
+
+    class_lock(arena, sIndex);
+    if (engine == ENGINE_TLSF && sIndex != -1)
+    {
+        // Only the head of the list asize maps to is considered
+        tlsf_mapping(asize, &fl, &sl);
+        block = arena -> tlsf[fl][sl];
+    }
+    else
+    {
+        // Every mini block is an exact fit, so the mini list is never walked
+        block = (sIndex == -1) ? arena -> smallListHeader : arena -> listHeader[sIndex];
+        if (sIndex == TREE_CLASS)
+        {
+            // The smallest fit is exact or there is none; treap nodes have
+            // no list links to walk
+            block = treap_fit(block, asize);
+        }
+        else
+        {
+            if (sIndex != -1 && order[sIndex] == ORDER_LIFO)
+                indexed = exact_find(arena, sIndex, asize);
+            if (indexed != NULL)
+                block = indexed;
+            while (block != NULL && get_size(block) != asize && t++ < THRESHFIT)
+                block = link_next(block);
+        }
+    }
+    if (block != NULL && get_size(block) != asize)
+        block = NULL;
+    if (block != NULL)
+        listDelete(arena, block);
+    class_unlock(arena, sIndex);
+    return block;
+}
+/*
  * <what does your heap checker do?>
- * Please keep modularity in mind when you're writing the heap checker!
+ * Checks the next slice of the heap and of the free lists, check_budget
+ * blocks of each, and returns false, after printing what is wrong, on the
+ * first inconsistency. Successive calls cover the heap over and over; with
+ * a budget past the number of blocks, each call checks all of it.
+ * The heap walk checks sizes, ABIT, footers, coalescing and list
+ * membership; the list walk checks that entries are listed free blocks of
+ * the arena and of the list's size class, with sound footers and ABIT,
+ * and that their links agree. Under LOCK_FINE blocks off the lists change
+ * without a lock, so there is no heap walk: allocated blocks and coalescing
+ * go unchecked, and only the list walk runs, each list under its lock.
  */
-bool mm_checkheap(int line)  
-{ 
-    (void)line; // delete this line; it's a placeholder so that the compiler
-                // will not warn you about an unused variable.
+bool mm_checkheap(int line)
+{
+    bool ok = true;
+
+    if (heap_start == NULL || check_budget == 0)
+        return true;
+#if LOCKING == LOCK_FINE
+    lock_acquire(&check_lock);
+#endif
+    global_lock();
+#if LOCKING != LOCK_FINE
+    ok = check_heap_slice(line);
+#endif
+    if (ok)
+        ok = check_list_slice(line);
+    global_unlock();
+#if LOCKING == LOCK_FINE
+    lock_release(&check_lock);
+#endif
+    return ok;
+}
+
+/*
+ * check_fail: reports an inconsistency found by mm_checkheap, called from
+ *             line, and returns false.
+ */
+static bool check_fail(int line, block_t *block, const char *what)
+{
+    (void)line;
+    (void)block;
+    (void)what;
+    dbg_printf("mm_checkheap (line %d): %s at %p\n", line, what, (void *)block);
+    return false;
+}
+
+/*
+ * check_heap_slice: walks the next check_budget blocks of the heap, from
+ *                   segment to segment, and stops early at the end of a
+ *                   pass.
+ */
+static bool check_heap_slice(int line)
+{
+    block_t *block;
+    size_t k;
+
+    for (k = 0; k < check_budget; k++)
+    {
+        block = (check_heap_at != NULL) ? check_heap_at : heap_start;
+        if (get_size(block) != 0)
+        {
+            if (!check_heap_block(line, block))
+                return false;
+            check_heap_at = find_next(block);
+            continue;
+        }
+        if (!get_alloc(block))
+            return check_fail(line, block, "end header not allocated");
+        check_heap_at = next_segment(block);
+        if (check_heap_at == NULL)
+            break;
+        if (*find_prev_footer(check_heap_at) != pack(0, true))
+            return check_fail(line, check_heap_at, "bad prologue footer");
+    }
+    return true;
+}
+
+/*
+ * check_heap_block: checks a block met by the heap walk: its size, the
+ *                   ABIT its next block keeps for it, and, if it
+ *                   is free, its footer, that it is coalesced and that it is
+ *                   linked into the list its size maps to, or is the top of
+ *                   its arena if it ends the newest segment.
+ */
+static bool check_heap_block(int line, block_t *block)
+{
+    word_t header = block -> header;
+    size_t size = extract_size(header);
+    bool alloc = extract_alloc(header);
+    block_t *next, *node, *head;
+    arena_t *arena;
+    int fl, sl;
+
+    if (size % dsize != 0 || size < dsize
+        || (char *)block + size + wsize > (char *)mem_heap_hi() + 1)
+        return check_fail(line, block, "bad block size");
+    next = find_next(block);
+    if (((next -> header & ABIT) != 0) != alloc)
+        return check_fail(line, next, "ABIT disagrees with the previous block");
+    if (alloc)
+    {
+        if (header & LBIT)
+            return check_fail(line, block, "allocated block marked listed");
+        return true;
+    }
+
+    arena = &arenas[page_arena[((char *)block - heap_lo) >> PAGE_SHIFT] & PAGE_ARENA];
+    if (footer_size(*find_prev_footer(next)) != size)
+        return check_fail(line, block, "footer disagrees with the header");
+    if (!get_alloc(next))
+        return check_fail(line, next, "free blocks not coalesced");
+    if (next == arena -> epilogue && block != arena -> top)
+        return check_fail(line, block, "free block ends the segment but is not the top");
+    if (block == arena -> top)
+        return (header & LBIT) ? check_fail(line, block, "top on a free list") : true;
+    if (!(header & LBIT))
+        return check_fail(line, block, "free block on no list");
+
+    if (size == dsize)
+        head = arena -> smallListHeader;
+    else if (engine == ENGINE_TLSF)
+    {
+        tlsf_mapping(size, &fl, &sl);
+        head = arena -> tlsf[fl][sl];
+    }
+    else if (getList(size) != TREE_CLASS)
+        head = arena -> listHeader[getList(size)];
+    else
+    {
+        // The treap is ordered, so searching for the block must find it
+        node = arena -> listHeader[TREE_CLASS];
+        while (node != NULL && node != block)
+            node = treap_before(block, node) ? node -> payload.tree.left
+                                             : node -> payload.tree.right;
+        if (node == NULL)
+            return check_fail(line, block, "free block missing from the treap");
+        return true;
+    }
+    return check_links(line, block, head);
+}
+
+/*
+ * check_links: checks that both neighbours of a block in a doubly linked
+ *              list, or the list head, point back at it.
+ */
+static bool check_links(int line, block_t *block, block_t *head)
+{
+    size_t limit = mem_heapsize();
+    block_t *prev, *next;
+
+    if (block -> payload.link.next >= limit || block -> payload.link.prev >= limit)
+        return check_fail(line, block, "link outside the heap");
+    prev = link_block(block -> payload.link.prev);
+    next = link_block(block -> payload.link.next);
+    if (prev == NULL ? head != block : prev -> payload.link.next != link_offset(block))
+        return check_fail(line, block, "previous link does not lead back");
+    if (next != NULL && next -> payload.link.prev != link_offset(block))
+        return check_fail(line, block, "next link does not lead back");
+    return true;
+}
+
+/*
+ * check_exact: checks the exact-size index links of a class list entry:
+ *              that its slot holds its size and that both neighbours on
+ *              its chain, or the slot, point back at it.
+ */
+static bool check_exact(int line, arena_t *arena, int sIndex, block_t *block, size_t size)
+{
+    exact_t *slot = exact_slot(arena, sIndex, size);
+    uint32_t next = block -> payload.link.same_next;
+    uint32_t prev = block -> payload.link.same_prev;
+    size_t limit = mem_heapsize();
+
+    if (prev == EXACT_NONE)
+        return true;
+    if (next >= limit || prev >= limit)
+        return check_fail(line, block, "exact-size link outside the heap");
+    if (slot -> size != size)
+        return check_fail(line, block, "exact-size chain in a slot of another size");
+    if (prev == 0 ? slot -> head != link_offset(block)
+                  : link_block(prev) -> payload.link.same_next != link_offset(block))
+        return check_fail(line, block, "previous exact-size link does not lead back");
+    if (next != 0 && link_block(next) -> payload.link.same_prev != link_offset(block))
+        return check_fail(line, block, "next exact-size link does not lead back");
+    return true;
+}
+
+/*
+ * check_order: checks that a class list entry sits where the class's order
+ *              puts it: a FIFO list ends at its tail, and an address-ordered
+ *              list rises and holds the same blocks as its address treap.
+ */
+static bool check_order(int line, arena_t *arena, int sIndex, block_t *block)
+{
+    block_t *next = link_next(block), *node;
+
+    if (order[sIndex] == ORDER_FIFO && next == NULL && arena -> listTail[sIndex] != block)
+        return check_fail(line, block, "FIFO list does not end at its tail");
+    if (order[sIndex] != ORDER_ADDR)
+        return true;
+    if (next != NULL && next < block)
+        return check_fail(line, block, "address-ordered list out of order");
+    node = link_block(arena -> addrRoot[sIndex]);
+    while (node != NULL && node != block)
+        node = link_block((block < node) ? node -> payload.addr.left : node -> payload.addr.right);
+    if (node == NULL)
+        return check_fail(line, block, "free block missing from the address treap");
     return true;
 }
 
+/*
+ * check_pack: checks the packed entry of a class list entry: a packed block
+ *             has its size there and follows a packed block of lower rank
+ *             or the head;
+ *             a loose one follows a block and is counted as loose.
+ */
+static bool check_pack(int line, arena_t *arena, int sIndex, block_t *block)
+{
+    int k = pack_find(arena, sIndex, block), j;
+    block_t *prev = link_block(block -> payload.link.prev);
+
+    if (k < 0)
+    {
+        if (prev == NULL || arena -> pack_loose[sIndex] == 0)
+            return check_fail(line, block, "loose block not past the packed ones");
+        return true;
+    }
+    if (arena -> pack_size[sIndex][k / PACK_VEC][k % PACK_VEC] != (int32_t)get_size(block))
+        return check_fail(line, block, "packed size disagrees with the header");
+    j = (prev != NULL) ? pack_find(arena, sIndex, prev) : -1;
+    if (prev != NULL && j < 0)
+        return check_fail(line, block, "packed block after a loose one");
+    if (j >= 0 && arena -> pack_rank[sIndex][j / PACK_VEC][j % PACK_VEC]
+                  >= arena -> pack_rank[sIndex][k / PACK_VEC][k % PACK_VEC])
+        return check_fail(line, block, "packed rank not above the previous block's");
+    if (link_next(block) == NULL && arena -> pack_last[sIndex] != block)
+        return check_fail(line, block, "last block packed but not the packed end");
+    return true;
+}
+
+/*
+ * check_list_head: returns the head of list number list of the arena, and
+ *                  in *sIndex the class lock that guards it, or NULL past
+ *                  the last list. List 0 is the mini list, then come the
+ *                  classes below TREE_CLASS or the TLSF lists; the treap is
+ *                  searched by the heap walk instead.
+ */
+static block_t **check_list_head(arena_t *arena, int list, int *sIndex)
+{
+    if (list == 0)
+    {
+        *sIndex = -1;
+        return &arena -> smallListHeader;
+    }
+    list--;
+    if (engine == ENGINE_TLSF)
+    {
+        if (list >= TLSF_FL * TLSF_SL)
+            return NULL;
+        *sIndex = 0;
+        return &arena -> tlsf[list / TLSF_SL][list % TLSF_SL];
+    }
+    if (list >= TREE_CLASS)
+        return NULL;
+    *sIndex = list;
+    return &arena -> listHeader[list];
+}
+
+/*
+ * check_list_entry: checks an entry of list number list of the arena: that
+ *                   it is a listed free block of the arena, of the list's
+ *                   size class, with a sound footer and links, and that the
+ *                   next block's ABIT agrees. The class lock keeps
+ *                   all of these still, even under LOCK_FINE.
+ */
+static bool check_list_entry(int line, arena_t *arena, int list, block_t *block, block_t *head)
+{
+    word_t next;
+    size_t size;
+    bool wrong;
+    int fl, sl;
+
+    if ((char *)block < heap_lo + wsize || (char *)block + dsize > (char *)mem_heap_hi() + 1
+        || (uintptr_t)header_to_payload(block) % dsize != 0)
+        return check_fail(line, block, "list entry outside the heap");
+    if ((page_arena[((char *)block - heap_lo) >> PAGE_SHIFT] & PAGE_ARENA) != arena -> id)
+        return check_fail(line, block, "list entry of another arena");
+    if (!is_listed(header_load(block)))
+        return check_fail(line, block, "list entry not a listed free block");
+
+    size = extract_size(header_load(block));
+    if (list == 0)
+        wrong = (size != dsize);
+    else if (size <= dsize)
+        wrong = true;
+    else if (engine == ENGINE_TLSF)
+    {
+        tlsf_mapping(size, &fl, &sl);
+        wrong = (fl * TLSF_SL + sl != list - 1);
+    }
+    else
+        wrong = (getList(size) != list - 1);
+    if (wrong)
+        return check_fail(line, block, "list entry of the wrong size class");
+    if (footer_size(*(word_t *)((char *)block + size - wsize)) != size)
+        return check_fail(line, block, "footer disagrees with the header");
+    next = header_load(find_next(block));
+    if ((next & ABIT) != 0)
+        return check_fail(line, block, "ABIT of the next block says allocated");
+    if (list != 0 && engine == ENGINE_SEGLIST && order[list - 1] == ORDER_LIFO
+        && !check_exact(line, arena, list - 1, block, size))
+        return false;
+    if (list != 0 && engine == ENGINE_SEGLIST && !check_order(line, arena, list - 1, block))
+        return false;
+    if (list != 0 && engine == ENGINE_SEGLIST && !check_pack(line, arena, list - 1, block))
+        return false;
+    return check_links(line, block, head);
+}
+
+/*
+ * check_list_slice: walks the next check_budget entries of the free lists,
+ *                   arena by arena, each list under its class lock. Every
+ *                   list looked at costs one entry, so empty ones are cheap
+ *                   to skip; the walk stops early after a full pass.
+ */
+static bool check_list_slice(int line)
+{
+    size_t k = 0;
+    int sIndex = 0, arenas_done = 0;
+    arena_t *arena;
+    block_t **head, *block;
+    bool ok = true;
+
+    while (k < check_budget && ok)
+    {
+        arena = &arenas[check_arena];
+        head = check_list_head(arena, check_list, &sIndex);
+        if (head == NULL)
+        {
+            check_list = 0;
+            check_arena = (check_arena + 1) % ARENAS;
+            if (++arenas_done == ARENAS)
+                break;
+            continue;
+        }
+
+        class_lock(arena, sIndex);
+        block = check_list_mid ? __atomic_load_n(&check_list_at, __ATOMIC_RELAXED) : *head;
+        for (k++; block != NULL && k < check_budget; k++)
+        {
+            ok = check_list_entry(line, arena, check_list, block, *head);
+            if (!ok)
+                break;
+            block = link_next(block);
+        }
+        check_list_mid = (block != NULL);
+        __atomic_store_n(&check_list_at, check_list_mid ? block : NULL, __ATOMIC_RELAXED);
+        class_unlock(arena, sIndex);
+        if (!check_list_mid)
+            check_list++;
+    }
+    return ok;
+}
+
+/*
+ * next_segment: returns the first block of the segment after the one whose
+ *               end header is end, or NULL if that was the last segment.
+ *               A segment starts with a prologue footer on the page that
+ *               follows the end of the previous one.
+ */
+static block_t *next_segment(block_t *end)
+{
+    char *start = heap_lo + round_up((size_t)((char *)end + wsize - heap_lo), 1 << PAGE_SHIFT);
+
+    if (start >= (char *)mem_heap_hi() + 1)
+        return NULL;
+    return (block_t *)(start + wsize);
+}
+
+/*
+ * check_merged: moves the heap walk back to a block that has just grown
+ *               over the block it was about to check.
+ */
+static void check_merged(block_t *block)
+{
+#if LOCKING != LOCK_FINE
+    if (check_heap_at > block && check_heap_at < find_next(block))
+        check_heap_at = block;
+#endif
+}
+
 /*
  * max: returns x if x > y, and y otherwise.
  */
@@ -859,6 +4970,22 @@ static size_t extract_size(word_t word)
     return (word & size_mask);
 }
 
+/*
+ * footer_size: returns the size of a free block given the word that ends
+ *              it: its footer, or, in a mini block, its list links. A
+ *              footer is a multiple of 16 below 4 GB. A link offset is 0 or
+ *              8 more than a multiple of 16, since blocks start 8 bytes
+ *              past a 16-byte boundary and heap_lo is on one. So a word
+ *              with its low 4 bits or its high half set, or zero, holds
+ *              links, and the block is a mini block.
+ */
+static size_t footer_size(word_t word)
+{
+    if (word == 0 || (word & 0xF) != 0 || (word >> 32) != 0)
+        return dsize;
+    return (size_t)word;
+}
+
 /*
  * get_size: returns the size of a given block by clearing the lowest 4 bits
  *           (as the heap is 16-byte aligned).
@@ -924,7 +5051,7 @@ static word_t *find_prev_footer(block_t *block)
 static block_t *find_prev(block_t *block)
 {
     word_t *footerp = find_prev_footer(block);
-    size_t size = extract_size(*footerp);
+    size_t size = footer_size(*footerp);
     return (block_t *)((char *)block - size);
 }
 
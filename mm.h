@@ -8,6 +8,13 @@ extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 extern void *mm_calloc (size_t nmemb, size_t size);
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+extern void mm_free_batch(void **ptrs, size_t n);
+extern void mm_free_sized(void *ptr, size_t size);
+extern void *mm_malloc_usable(size_t size, size_t *usable);
+extern void *mm_memalign(size_t align, size_t size);
+extern int mm_posix_memalign(void **memptr, size_t align, size_t size);
+extern void *mm_aligned_alloc(size_t align, size_t size);
 
 #else
 
@@ -16,6 +23,13 @@ extern void *malloc (size_t size);
 extern void free (void *ptr);
 extern void *realloc(void *ptr, size_t size);
 extern void *calloc (size_t nmemb, size_t size);
+extern size_t malloc_batch(size_t size, size_t n, void **out);
+extern void free_batch(void **ptrs, size_t n);
+extern void free_sized(void *ptr, size_t size);
+extern void *malloc_usable(size_t size, size_t *usable);
+extern void *memalign(size_t align, size_t size);
+extern int posix_memalign(void **memptr, size_t align, size_t size);
+extern void *aligned_alloc(size_t align, size_t size);
 
 #endif
 
@@ -23,3 +37,39 @@ extern bool mm_init(void);
 
 /* This is for debugging.  Returns false if error encountered */
 extern bool mm_checkheap(int lineno);
+
+/* Prints acquisition and wait-time counters of every lock used since mm_init */
+extern void mm_lock_report(FILE *out);
+
+/* Allocator statistics, filled in by mm_get_stats. Per-class arrays start
+ * with the 16-byte mini list, followed by the size classes of the free lists */
+#define MM_STATS_CLASSES 13
+
+typedef struct mm_stats
+{
+    /* Events since mm_init, counted only if mm.c is built with -DSTATS=1 */
+    unsigned long fit_hits[MM_STATS_CLASSES];    /* find_fit found a block, by request class */
+    unsigned long fit_misses[MM_STATS_CLASSES];  /* find_fit found none */
+    unsigned long fit_visited[MM_STATS_CLASSES]; /* free blocks find_fit looked at */
+    unsigned long fit_cutoffs;     /* searches cut short by THRESHFIT */
+    unsigned long coalesce[4];     /* coalesce cases: no free neighbour, next, previous, both */
+    unsigned long place_split;     /* place split a free remainder off */
+    unsigned long place_whole;     /* place handed out the whole block */
+    unsigned long extend_calls;    /* extend_heap calls that grew the heap */
+    unsigned long extend_bytes;
+    /* The heap when the snapshot is taken */
+    unsigned long free_blocks[MM_STATS_CLASSES]; /* blocks on the free lists, by class */
+    size_t free_bytes[MM_STATS_CLASSES];
+    size_t payload_bytes;   /* usable bytes of allocated blocks and objects */
+    size_t metadata_bytes;  /* headers, slab run headers, buddy tags, segment bounds, padding */
+    size_t idle_bytes;      /* free slab slots, free buddy blocks, fastbin and tcache blocks */
+    size_t heap_bytes;      /* size of the heap */
+    size_t mapped_bytes;    /* direct mappings outside the heap */
+} mm_stats_t;
+
+/* Takes a snapshot of the allocator statistics. Returns false if the event
+ * counters were not compiled in */
+extern bool mm_get_stats(mm_stats_t *stats);
+
+/* Sets a run-time allocator option by name. Returns false if unknown */
+extern bool mm_set_option(const char *name, long value);
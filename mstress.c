@@ -0,0 +1,331 @@
+/*
+ * mstress.c - Threaded stress driver for the allocator in mm.c
+ *
+ * Each thread keeps a table of blocks and, at random, allocates, resizes
+ * or frees them, and hands blocks to the other threads through a shared
+ * exchange, so that frees cross arenas and go through the remote-free
+ * queues. Every block is filled with a pattern that is checked before the
+ * block is resized or freed, and mm_checkheap runs as the threads go.
+ *
+ * Build one driver per locking mode (make stress builds and runs them);
+ * mm.c built with LOCKING=0 (LOCK_NONE) only supports -t 1.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <getopt.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define MAXTHREADS 64   /* most threads -t accepts */
+#define SLOTS     1000  /* blocks each thread holds at a time */
+#define EXCHANGE   256  /* blocks in transit between threads */
+#define BATCH       16  /* most blocks of one malloc_batch */
+
+/* A block and what it must hold: size bytes of the pattern of seed */
+typedef struct {
+    unsigned char *p;
+    size_t size;
+    unsigned seed;
+} slot_t;
+
+static int num_threads = 4;    /* threads to run (-t) */
+static long num_ops = 20000;   /* operations per thread (-n) */
+static long check_every = 0;   /* mm_checkheap every this many ops, 0 for none (-c) */
+static unsigned base_seed = 1; /* seed of the first thread (-s) */
+
+/* The exchange: a thread swaps one of its blocks for the one in a random
+ * slot and frees what it gets, which was usually allocated elsewhere */
+static slot_t exchange[EXCHANGE];
+static pthread_mutex_t exchange_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Set by the first thread that finds a problem; the others stop */
+static volatile bool failed = false;
+
+static void *worker(void *arg);
+static size_t random_size(unsigned *seed);
+static void fill(slot_t *s);
+static bool verify(const slot_t *s, const char *what);
+static void release(slot_t *s);
+static void fail(const char *what);
+static void usage(char *prog);
+
+int main(int argc, char **argv)
+{
+    pthread_t threads[MAXTHREADS];
+    char *eq;
+    int c, i;
+
+    while ((c = getopt(argc, argv, "t:n:c:s:o:h")) != EOF) {
+        switch (c) {
+        case 't': /* Number of threads */
+            num_threads = atoi(optarg);
+            break;
+        case 'n': /* Operations per thread */
+            num_ops = atol(optarg);
+            break;
+        case 'c': /* Check the heap every n operations */
+            check_every = atol(optarg);
+            break;
+        case 's': /* Random seed */
+            base_seed = (unsigned)atol(optarg);
+            break;
+        case 'o': /* Set an allocator option, as name=value */
+            eq = strchr(optarg, '=');
+            if (eq == NULL) {
+                usage(argv[0]);
+                exit(1);
+            }
+            *eq = '\0';
+            if (!mm_set_option(optarg, strtol(eq + 1, NULL, 0))) {
+                fprintf(stderr, "Unknown allocator option %s=%s\n", optarg, eq + 1);
+                exit(1);
+            }
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (num_threads < 1 || num_threads > MAXTHREADS || num_ops < 0) {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    mem_init();
+    if (!mm_init()) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+
+    for (i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, worker, (void *)(uintptr_t)i) != 0) {
+            fprintf(stderr, "pthread_create failed\n");
+            exit(1);
+        }
+    }
+    for (i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    /* What is left in the exchange is freed by the main thread */
+    for (i = 0; i < EXCHANGE && !failed; i++) {
+        if (exchange[i].p != NULL && verify(&exchange[i], "exchanged block"))
+            release(&exchange[i]);
+    }
+    if (!failed && !mm_checkheap(__LINE__))
+        fail("mm_checkheap failed at the end");
+    if (failed)
+        exit(1);
+
+    printf("ok: %d threads x %ld ops, heap %zu bytes\n",
+           num_threads, num_ops, mem_heapsize());
+    mm_lock_report(stdout);
+    mem_deinit();
+    return 0;
+}
+
+/*
+ * worker - run num_ops random operations on a table of blocks, then free
+ *          what is left
+ */
+static void *worker(void *arg)
+{
+    slot_t slots[SLOTS], held;
+    void *batch[BATCH];
+    unsigned seed = base_seed + 7919 * (unsigned)(uintptr_t)arg;
+    unsigned char *q;
+    size_t size, n, k, j;
+    long op;
+    int i, x;
+
+    memset(slots, 0, sizeof(slots));
+    for (op = 0; op < num_ops && !failed; op++) {
+        if (check_every != 0 && op % check_every == 0 && !mm_checkheap(__LINE__)) {
+            fail("mm_checkheap failed");
+            break;
+        }
+        i = rand_r(&seed) % SLOTS;
+        x = rand_r(&seed) % 10;
+
+        if (slots[i].p == NULL) {
+            /* Allocate, in one of four ways */
+            size = random_size(&seed);
+            if (x < 6)
+                q = mm_malloc(size);
+            else if (x < 8) {
+                q = mm_calloc(1, size);
+                for (j = 0; q != NULL && j < size; j++) {
+                    if (q[j] != 0) {
+                        fail("mm_calloc returned nonzero bytes");
+                        break;
+                    }
+                }
+            }
+            else if (x < 9)
+                q = mm_memalign((size_t)64 << (rand_r(&seed) % 7), size);
+            else {
+                /* A batch fills the free slots from i on */
+                for (n = 0; n < BATCH && i + n < SLOTS && slots[i + n].p == NULL; n++)
+                    ;
+                size = 1 + rand_r(&seed) % 512;
+                k = mm_malloc_batch(size, n, batch);
+                if (k != n) {
+                    fail("mm_malloc_batch came up short");
+                    break;
+                }
+                for (j = 0; j < n; j++) {
+                    slots[i + j].p = batch[j];
+                    slots[i + j].size = size;
+                    slots[i + j].seed = rand_r(&seed);
+                    fill(&slots[i + j]);
+                }
+                continue;
+            }
+            if (q == NULL) {
+                fail("allocation failed");
+                break;
+            }
+            if ((uintptr_t)q % 16 != 0) {
+                fail("payload not 16-byte aligned");
+                break;
+            }
+            slots[i].p = q;
+            slots[i].size = size;
+            slots[i].seed = rand_r(&seed);
+            fill(&slots[i]);
+            continue;
+        }
+
+        if (!verify(&slots[i], "block"))
+            break;
+        if (x < 2) {
+            /* Resize, keeping the common prefix */
+            size = random_size(&seed);
+            q = mm_realloc(slots[i].p, size);
+            if (q == NULL) {
+                fail("mm_realloc failed");
+                break;
+            }
+            slots[i].p = q;
+            if (size < slots[i].size)
+                slots[i].size = size;
+            if (!verify(&slots[i], "reallocated block"))
+                break;
+            slots[i].size = size;
+            fill(&slots[i]);
+        }
+        else if (x < 5) {
+            /* Hand the block over, freeing the one it replaces */
+            pthread_mutex_lock(&exchange_lock);
+            j = rand_r(&seed) % EXCHANGE;
+            held = exchange[j];
+            exchange[j] = slots[i];
+            pthread_mutex_unlock(&exchange_lock);
+            slots[i].p = NULL;
+            if (held.p != NULL) {
+                if (!verify(&held, "exchanged block"))
+                    break;
+                release(&held);
+            }
+        }
+        else
+            release(&slots[i]);
+    }
+
+    for (i = 0; i < SLOTS && !failed; i++) {
+        if (slots[i].p != NULL && verify(&slots[i], "block"))
+            release(&slots[i]);
+    }
+    return NULL;
+}
+
+/*
+ * random_size - mostly small requests, some of a few KB, and a few big
+ *               enough for the large classes and direct mappings
+ */
+static size_t random_size(unsigned *seed)
+{
+    int x = rand_r(seed) % 100;
+
+    if (x < 60)
+        return 1 + rand_r(seed) % 64;
+    if (x < 90)
+        return 1 + rand_r(seed) % 1024;
+    if (x < 99)
+        return 1 + rand_r(seed) % 40000;
+    return 1 + rand_r(seed) % 300000;
+}
+
+/*
+ * fill - write the block's pattern
+ */
+static void fill(slot_t *s)
+{
+    size_t i;
+
+    for (i = 0; i < s->size; i++)
+        s->p[i] = (unsigned char)(s->seed * 31 + i);
+}
+
+/*
+ * verify - check that the block still holds its pattern
+ */
+static bool verify(const slot_t *s, const char *what)
+{
+    size_t i;
+    char msg[128];
+
+    for (i = 0; i < s->size; i++) {
+        if (s->p[i] != (unsigned char)(s->seed * 31 + i)) {
+            snprintf(msg, sizeof(msg), "%s %p corrupted at byte %zu of %zu",
+                     what, (void *)s->p, i, s->size);
+            fail(msg);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * release - free a block, with mm_free_sized for every other one
+ */
+static void release(slot_t *s)
+{
+    if (s->seed & 1)
+        mm_free_sized(s->p, s->size);
+    else
+        mm_free(s->p);
+    s->p = NULL;
+}
+
+/*
+ * fail - report a problem and stop every thread
+ */
+static void fail(const char *what)
+{
+    fprintf(stderr, "ERROR: %s\n", what);
+    failed = true;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(char *prog)
+{
+    fprintf(stderr, "Usage: %s [-h] [-t <threads>] [-n <ops>] [-c <n>] [-s <seed>] [-o <n>=<v>]\n", prog);
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-t <i>     Run <i> threads (default 4, at most %d).\n", MAXTHREADS);
+    fprintf(stderr, "\t-n <i>     Operations per thread (default 20000).\n");
+    fprintf(stderr, "\t-c <i>     Run mm_checkheap every <i> operations (default 0, never).\n");
+    fprintf(stderr, "\t-s <i>     Random seed (default 1).\n");
+    fprintf(stderr, "\t-o <n>=<v> Set allocator option <n> to <v> (e.g. slab=0)\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+}